@@ -1,6 +1,9 @@
 #ifndef __ACCEL_H__
 #define __ACCEL_H__
 
+#include <iosfwd>
+
+#include "rdr/ray.h"
 #include "rdr/rdr.h"
 
 RDR_NAMESPACE_BEGIN
@@ -9,6 +12,34 @@ RDR_NAMESPACE_BEGIN
 bool TriangleIntersect(Ray &ray, const uint32_t &triangle_index,
     const ref<TriangleMeshResource> &mesh, SurfaceInteraction &interaction);
 
+/**
+ * @brief The minimal record of a hit, from which the SurfaceInteraction is
+ * computed once the hit is known to be the closest one. Candidates overwritten
+ * by closer hits thus never pay for their differential geometry.
+ */
+struct HitRecord {
+  uint32_t index{0};  ///<! the triangle of a mesh, unused by spheres
+  Vec3f b{};          ///<! barycentric coordinates w.r.t. the triangle
+};
+
+/**
+ * @brief Same as TriangleIntersect, but only shrink the time range of the ray
+ * and record the hit, without computing the SurfaceInteraction
+ */
+bool TriangleIntersectHit(Ray &ray, const uint32_t &triangle_index,
+    const TriangleMeshResource &mesh, HitRecord &hit);
+
+/**
+ * @brief Single-precision watertight ray-triangle test (Woop et al. 2013). Rays
+ * hitting a shared edge or vertex never slip through both triangles. Only
+ * the distance and the barycentric coordinates are computed.
+ *
+ * @param t_hit distance of the hit, within the time range of the ray
+ * @param b barycentric coordinates w.r.t. (p0, p1, p2)
+ */
+bool WatertightTriangleIntersect(const Ray &ray, const Vec3f &p0,
+    const Vec3f &p1, const Vec3f &p2, Float *t_hit, Vec3f *b);
+
 /**
  * @brief The bounding box
  */
@@ -97,6 +128,76 @@ struct AABB : public TAABB<Vec3f> {
   }
 };
 
+/**
+ * @brief Triangles gathered in the order they are referenced by the leaves of
+ * an acceleration structure, stored as Struct of Array. Visiting a leaf thus
+ * reads contiguous memory instead of gathering vertices through v_indices.
+ */
+struct PackedTriangles {
+  vector<Vec3f> v0, v1, v2;         //<! vertices in leaf order
+  vector<uint32_t> triangle_index;  //<! index of the triangle in the mesh
+  bool double_precision{false};     //<! use TriangleIntersect for debugging
+
+  size_t size() const { return triangle_index.size(); }
+  void clear();
+
+  /// The number of bytes allocated for the triangles
+  size_t getMemoryUsage() const;
+
+  /// Append the triangle_index-th triangle of the mesh
+  void push_back(const TriangleMeshResource &mesh, uint32_t triangle_index);
+
+  /// Intersect the i-th packed triangle, record the hit and shrink the time
+  /// range of the ray. The mesh must be the one the triangles are gathered
+  /// from.
+  bool intersectHit(Ray &ray, uint32_t i, const TriangleMeshResource &mesh,
+      HitRecord &hit) const;
+
+  /// Same as intersectHit(), but fill the whole interaction on hit
+  bool intersect(Ray &ray, uint32_t i, const ref<TriangleMeshResource> &mesh,
+      SurfaceInteraction &interaction) const;
+
+  /// Any-hit test of the i-th packed triangle
+  bool occluded(const Ray &ray, uint32_t i,
+      const ref<TriangleMeshResource> &mesh) const;
+
+  /// @see BVHCache, load() checks the triangles against the mesh
+  void save(std::ostream &stream) const;
+  bool load(std::istream &stream, const TriangleMeshResource &mesh);
+};
+
+/**
+ * @brief Counters of the traversal work, e.g. for heatmaps. The traversals of
+ * BVHTree and WideBVHAccel add to the counters bound to the calling thread by
+ * a TraversalStatsScope, and cost a single branch per node otherwise.
+ */
+struct TraversalStats {
+  uint64_t node_visits{0};      ///<! nodes whose bounds are tested
+  uint64_t primitive_tests{0};  ///<! data nodes tested, e.g. triangles
+};
+
+/// The counters bound to the calling thread, nullptr if none
+inline TraversalStats *&CurrentTraversalStats() {
+  thread_local TraversalStats *stats = nullptr;
+  return stats;
+}
+
+/// Bind the counters to the calling thread during the lifetime of the scope
+class TraversalStatsScope {
+public:
+  explicit TraversalStatsScope(TraversalStats &stats)
+      : previous(CurrentTraversalStats()) {
+    CurrentTraversalStats() = &stats;
+  }
+  ~TraversalStatsScope() { CurrentTraversalStats() = previous; }
+
+  TraversalStatsScope(const TraversalStatsScope &)            = delete;
+  TraversalStatsScope &operator=(const TraversalStatsScope &) = delete;
+
+private:
+  TraversalStats *previous;
+};
+
 /**
  * @brief Acceleration structure for ray-geometry intersection. Support triangle
  * mesh only. This is the base class for all acceleration structures such as
@@ -120,7 +221,8 @@ public:
   /**
    * @brief Intersect ray with the acceleration structure. The specification is,
    * if there's a hit, modify the interaction's terms except for material. Else
-   * do nothing.
+   * do nothing. The default is intersectHit() followed by
+   * computeSurfaceInteraction().
    *
    * @param ray
    * @param interaction
@@ -128,6 +230,63 @@ public:
    */
   virtual bool intersect(Ray &ray, SurfaceInteraction &interaction) const;
 
+  /**
+   * @brief Closest-hit query that only records the hit, such that the
+   * SurfaceInteraction is computed once for the final closest hit, e.g. among
+   * several shapes. The default tests every triangle.
+   */
+  virtual bool intersectHit(Ray &ray, HitRecord &hit) const;
+
+  /// Fill the interaction of a hit found by intersectHit(), in the space of
+  /// the structure
+  void computeSurfaceInteraction(
+      const HitRecord &hit, SurfaceInteraction &interaction) const;
+
+  /**
+   * @brief Any-hit query, return whether there is any hit within the time
+   * range of the ray. Neither the ray nor any interaction is modified, so the
+   * traversal can terminate at the first hit.
+   */
+  virtual bool occluded(const Ray &ray) const;
+
+  /**
+   * @brief Closest-hit query of the rays selected by mask, each of which
+   * behaves as if passed to intersect() with the interaction of the same
+   * index. Return the mask of rays with a hit. The default intersects the rays
+   * one after another.
+   */
+  virtual RayMask intersectPacket(
+      Ray *rays, SurfaceInteraction *interactions, RayMask mask) const;
+
+  /**
+   * @brief Update the built structure after the vertices of the mesh moved in
+   * place while the triangles stay the same, e.g. for animated meshes.
+   * Return false if the structure cannot be updated, which is the default, in
+   * which case a new structure has to be built instead.
+   */
+  virtual bool update();
+
+  /// The number of bytes allocated for the built structure, excluding the
+  /// mesh itself, e.g. to report the bytes per triangle
+  virtual size_t getMemoryUsage() const;
+
+  /// Human-readable quality statistics of the built structure, empty if not
+  /// available, which is the default
+  virtual std::string getStatistics() const;
+
+  /**
+   * @brief Serialize the built structure into a BVHCache. Return false if the
+   * structure cannot be cached, which is the default.
+   */
+  virtual bool save(std::ostream &stream) const;
+
+  /**
+   * @brief Restore the structure written by save() for the mesh, in place of
+   * setTriangleMesh() and build(). Return false if the data is corrupted.
+   */
+  virtual bool load(
+      std::istream &stream, const ref<TriangleMeshResource> &mesh);
+
 protected:
   ref<TriangleMeshResource>
       mesh{};  //<! The triangle mesh's underlying data to be intersected.
@@ -9,6 +9,8 @@ RDR_REGISTER_FACTORY(Integrator, [](const Properties &props) -> Integrator * {
   auto type = props.getProperty<std::string>("type", "path");
   if (type == "intersection_test") {
     return Memory::alloc<IntersectionTestIntegrator>(props);
+  } else if (type == "traversal_heatmap") {
+    return Memory::alloc<TraversalHeatmapIntegrator>(props);
   } else {
     print("Creating integrator of type: {}\n", type);
     Exception_("Integrator type {} not found", type);
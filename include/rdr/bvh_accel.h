@@ -33,6 +33,8 @@ public:
     return TriangleIntersect(ray, triangle_index, mesh.get(), interaction);
   }
 
+  int getTriangleIndex() const { return triangle_index; }
+
   AABB getBound() const {
     assert(mesh.get() != nullptr);
     const auto &v0 = mesh->getVertex(triangle_index * 3 + 0);
@@ -42,7 +44,11 @@ public:
   }
 
 private:
-  // The necessary information to perform TriangleIntersect
+  // The necessary information to perform TriangleIntersect. The mesh is
+  // repeated per triangle (a non-owning pointer, 8 bytes) only because
+  // getBound() takes no arguments. Traversal reads PackedTriangles instead;
+  // BVHAccel keeps these nodes for refit() and update() only, WideBVHAccel
+  // drops them after build().
   // clang-format off
   int triangle_index;
   ref<TriangleMeshResource> mesh{nullptr};
@@ -62,11 +68,82 @@ public:
 private:
   DataType data;
 };
+
+/// Select and tune the builder of a BVHTree from the "accel" block of a mesh
+template <typename TreeType>
+void ConfigureBVHTree(TreeType &tree, const Properties &props) {
+  const auto heuristic = props.getProperty<std::string>("heuristic", "sah");
+  if (heuristic == "sah") {
+    tree.setHeuristicProfile(
+        TreeType::EHeuristicProfile::ESurfaceAreaHeuristic);
+  } else if (heuristic == "median") {
+    tree.setHeuristicProfile(TreeType::EHeuristicProfile::EMedianHeuristic);
+  } else if (heuristic == "lbvh") {
+    tree.setHeuristicProfile(TreeType::EHeuristicProfile::ELinearHeuristic);
+  } else {
+    Exception_("BVH heuristic [ {} ] is not supported", heuristic);
+  }
+
+  BVHBuildSettings settings;
+  settings.sah_bins = props.getProperty<int>("sah_bins", settings.sah_bins);
+  settings.max_leaf_size =
+      props.getProperty<int>("max_leaf_size", settings.max_leaf_size);
+  settings.traversal_cost =
+      props.getProperty<Float>("traversal_cost", settings.traversal_cost);
+  settings.intersection_cost =
+      props.getProperty<Float>("intersection_cost", settings.intersection_cost);
+  settings.treelet_size =
+      props.getProperty<int>("treelet_size", settings.treelet_size);
+  settings.spatial_split_budget = props.getProperty<Float>(
+      "spatial_split_budget", settings.spatial_split_budget);
+  if (settings.sah_bins < 2 || settings.max_leaf_size < 1)
+    Exception_("Invalid BVH settings: sah_bins = {}, max_leaf_size = {}",
+        settings.sah_bins, settings.max_leaf_size);
+  if (settings.treelet_size != 0 &&
+      (settings.treelet_size < 3 ||
+          settings.treelet_size > TreeType::MAX_TREELET_SIZE))
+    Exception_("Invalid BVH settings: treelet_size = {}, expected 0 or 3 to {}",
+        settings.treelet_size, TreeType::MAX_TREELET_SIZE);
+  if (settings.spatial_split_budget < 0)
+    Exception_("Invalid BVH settings: spatial_split_budget = {}",
+        settings.spatial_split_budget);
+  if (settings.spatial_split_budget > 0 &&
+      (heuristic != "sah" || settings.treelet_size != 0))
+    Warn_("BVH settings heuristic = {}, treelet_size = {} are ignored, since "
+          "spatial_split_budget > 0 always builds an SBVH",
+        heuristic, settings.treelet_size);
+  tree.setBuildSettings(settings);
+}
+
+/**
+ * @brief Build the tree of the mesh with spatial splits (SBVH), which clip
+ * the triangles straddling a split plane into both children. Triangles might
+ * thus be referenced by many leaves, up to the spatial_split_budget of the
+ * tree's settings. This replaces push_back() and build() of the tree.
+ */
+void BuildSpatialSplitBVH(
+    BVHTree<BVHTriangleNode> &tree, const ref<TriangleMeshResource> &mesh);
 }  // namespace detail_
 
 /// A somehow very inefficient BVH implementation based on the general BVH class
 class BVHAccel final : public Accel {
 public:
+  /// Binned SAH with the default BVHBuildSettings
+  BVHAccel();
+
+  /**
+   * @brief Configure the builder from the "accel" block of a mesh, e.g.
+   * { "heuristic": "sah", "sah_bins": 16, "max_leaf_size": 4,
+   *   "traversal_cost": 1.0, "intersection_cost": 1.0, "treelet_size": 0 }
+   * "heuristic" can be "sah", "median", or "lbvh" for the fast Morton code
+   * builder, which is best combined with "treelet_size": 7. A positive
+   * "spatial_split_budget", e.g. 0.3, enables spatial splits for meshes with
+   * long and overlapping triangles.
+   * "max_degradation", e.g. 1.5 and at least 1, is the SAH cost growth beyond
+   * which update() rebuilds a subtree, see BVHTree::update.
+   * Set "double_precision" to use TriangleIntersect for debugging.
+   */
+  explicit BVHAccel(const Properties &props);
   ~BVHAccel() override = default;
 
   /// @see Accel::setTriangleMesh
@@ -78,13 +155,69 @@ public:
   /// @see Accel::getBound
   AABB getBound() const override;
 
-  /// @see Accel::intersect
-  bool intersect(Ray &ray, SurfaceInteraction &interaction) const override;
+  /// @see Accel::intersectHit
+  bool intersectHit(Ray &ray, HitRecord &hit) const override;
+
+  /// @see Accel::occluded
+  bool occluded(const Ray &ray) const override;
+
+  /// @see Accel::intersectPacket
+  RayMask intersectPacket(Ray *rays, SurfaceInteraction *interactions,
+      RayMask mask) const override;
+
+  /// @see Accel::update
+  bool update() override;
+
+  /// @see Accel::getMemoryUsage
+  size_t getMemoryUsage() const override;
+
+  /// @see Accel::getStatistics and BVHStats
+  std::string getStatistics() const override;
+
+  /// @see Accel::save
+  bool save(std::ostream &stream) const override;
+
+  /// @see Accel::load
+  bool load(
+      std::istream &stream, const ref<TriangleMeshResource> &mesh) override;
+
+  using TreeType = BVHTree<detail_::BVHTriangleNode>;
+
+  /// The built tree, which Scene descends into from its own traversal loop
+  const TreeType &getTree() const { return triangle_tree; }
+
+  /// Closest-hit test of the triangles of the leaf [span_left, span_right)
+  /// of getTree(), @see intersectHit
+  bool intersectLeaf(
+      Ray &ray, int span_left, int span_right, HitRecord &hit) const {
+    bool result = false;
+    for (int i = span_left; i < span_right; ++i)
+      result |= triangles.intersectHit(ray, i, *mesh, hit);
+    return result;
+  }
+
+  /// Any-hit test of the triangles of a leaf, @see intersectLeaf
+  bool occludedLeaf(const Ray &ray, int span_left, int span_right) const {
+    for (int i = span_left; i < span_right; ++i)
+      if (triangles.occluded(ray, i, mesh)) return true;
+    return false;
+  }
 
 private:
-  BVHTree<detail_::BVHTriangleNode> triangle_tree;
+  TreeType triangle_tree;        //<! its data nodes are kept for update()
+  PackedTriangles triangles;    //<! in the order of triangle_tree's leaves
+  Float max_degradation{1.5F};  //<! @see BVHTree::update
 };
 
+/**
+ * @brief Create the acceleration structure described by the "accel" block of a
+ * mesh. "type" can be "bvh" (default), "bvh4", "bvh8", or "embree" if enabled.
+ * "bvh4" and "bvh8" also accept "quantized", see WideBVHAccel. TriangleMesh
+ * additionally reads "cache" and "cache_dir" from the block, see BVHCache, and
+ * "stats" to log Accel::getStatistics after loading.
+ */
+ref<Accel> CreateAccel(const Properties &props);
+
 #ifdef USE_EMBREE
 class ExternalBVHAccel final : public Accel {
 public:
@@ -100,8 +233,11 @@ public:
   /// @see Accel::getBound
   AABB getBound() const override;
 
-  /// @see Accel::intersect
-  bool intersect(Ray &ray, SurfaceInteraction &interaction) const override;
+  /// @see Accel::intersectHit
+  bool intersectHit(Ray &ray, HitRecord &hit) const override;
+
+  /// @see Accel::occluded
+  bool occluded(const Ray &ray) const override;
 
 private:
   /// Embree properties
@@ -109,7 +245,6 @@ private:
   RTCScene scene;
   RTCGeometry geom;
   uint32_t geomId;
-  ref<TriangleMeshResource> mesh;
 };
 #endif  // USE_EMBREE
 
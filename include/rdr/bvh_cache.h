@@ -0,0 +1,109 @@
+/**
+ * @file bvh_cache.h
+ * @brief On-disk cache of triangle meshes together with their built
+ * acceleration structures, such that relaunching the renderer skips both the
+ * OBJ parsing and the BVH construction.
+ *
+ * A cache file is a fixed header followed by sections of trivially copyable
+ * arrays. Every section starts at a CACHE_ALIGNMENT boundary, so the file can
+ * be memory-mapped and used in place as well.
+ */
+#ifndef __BVH_CACHE_H__
+#define __BVH_CACHE_H__
+
+#include <istream>
+#include <ostream>
+
+#include "rdr/rdr.h"
+
+RDR_NAMESPACE_BEGIN
+
+namespace detail_ {
+/// The strictest alignment of the cached arrays, e.g. BVHTree::LinearNode
+constexpr size_t CACHE_ALIGNMENT = 32;
+
+inline void AlignCacheStream(std::ostream &stream) {
+  const char zeros[CACHE_ALIGNMENT] = {};
+  const auto pos = static_cast<size_t>(stream.tellp());
+  stream.write(zeros, (CACHE_ALIGNMENT - pos % CACHE_ALIGNMENT) %
+                          CACHE_ALIGNMENT);
+}
+
+inline void AlignCacheStream(std::istream &stream) {
+  const auto pos = static_cast<size_t>(stream.tellg());
+  stream.seekg((CACHE_ALIGNMENT - pos % CACHE_ALIGNMENT) % CACHE_ALIGNMENT,
+      std::ios::cur);
+}
+
+/// Write an array as [number of elements][padding][raw elements]
+template <typename T>
+void WriteCacheSection(std::ostream &stream, const vector<T> &data) {
+  static_assert(std::is_trivially_copyable_v<T>, "T must be a POD");
+  const uint64_t size = data.size();
+  stream.write(reinterpret_cast<const char *>(&size), sizeof(size));
+  AlignCacheStream(stream);
+  stream.write(
+      reinterpret_cast<const char *>(data.data()), size * sizeof(T));
+}
+
+/// Read an array written by WriteCacheSection, return false if truncated
+template <typename T>
+bool ReadCacheSection(std::istream &stream, vector<T> &data) {
+  static_assert(std::is_trivially_copyable_v<T>, "T must be a POD");
+  uint64_t size = 0;
+  stream.read(reinterpret_cast<char *>(&size), sizeof(size));
+  AlignCacheStream(stream);
+  if (!stream) return false;
+
+  // Never trust the size before comparing it against the file
+  const auto begin = stream.tellg();
+  stream.seekg(0, std::ios::end);
+  const auto remaining = static_cast<uint64_t>(stream.tellg() - begin);
+  stream.seekg(begin);
+  if (size > remaining / sizeof(T)) return false;
+
+  data.resize(size);
+  stream.read(reinterpret_cast<char *>(data.data()), size * sizeof(T));
+  return static_cast<bool>(stream);
+}
+}  // namespace detail_
+
+/// 64-bit non-cryptographic hash, only meant to key caches
+uint64_t HashBytes(const void *data, size_t size, uint64_t seed = 0);
+
+/// Hash the content of a file, throw if it cannot be read
+uint64_t HashFile(const fs::path &path);
+
+/**
+ * @brief A cache entry of one TriangleMesh. The key should cover everything
+ * the cached data depends on, i.e. the content of the mesh file, the
+ * transformation and the settings of the accel. Stale or corrupted files are
+ * treated as misses and overwritten by the next save().
+ */
+class BVHCache {
+public:
+  /// Bump this whenever a cached layout changes, e.g. LinearNode
+  constexpr static uint32_t VERSION = 1;
+
+  BVHCache(const fs::path &directory, uint64_t key);
+
+  /// <system temp directory>/rdr_bvh_cache
+  static fs::path GetDefaultDirectory();
+
+  const fs::path &getPath() const { return path; }
+
+  /// Restore the mesh and its built accel, return false on a miss
+  bool load(const ref<TriangleMeshResource> &mesh, Accel &accel) const;
+
+  /// Write the mesh and its built accel, return false if the accel cannot
+  /// be cached or the file cannot be written
+  bool save(const TriangleMeshResource &mesh, const Accel &accel) const;
+
+private:
+  fs::path path;
+  uint64_t key;
+};
+
+RDR_NAMESPACE_END
+
+#endif
@@ -30,6 +30,134 @@ protected:
   BVHNodeInterface &operator=(const BVHNodeInterface &) = default;
 };
 
+/**
+ * @brief Knobs of the BVH builder. They take effect on the SAH and the linear
+ * profiles, and on the optional treelet restructuring, where they trade build
+ * time for traversal quality.
+ */
+struct BVHBuildSettings {
+  int sah_bins{16};               ///<! number of centroid bins per split
+  int max_leaf_size{4};           ///<! spans larger than this are always split
+  Float traversal_cost{1.0F};     ///<! relative cost of visiting an inner node
+  Float intersection_cost{1.0F};  ///<! relative cost of testing one primitive
+  int treelet_size{0};            ///<! leaves per treelet, 0 to disable
+  /// Spatial splits may add this fraction of extra primitive references, 0
+  /// to disable. Only honored by triangle meshes, see BuildSpatialSplitBVH.
+  Float spatial_split_budget{0};
+};
+
+namespace detail_ {
+/// Run func(chunk, begin, end) on the fixed chunks of [0, n) as concurrent
+/// OpenMP tasks, and wait for all of them
+template <typename Func>
+void ForEachChunk(size_t n, size_t chunk_size, const Func &func) {
+  const size_t n_chunks = (n + chunk_size - 1) / chunk_size;
+  for (size_t chunk = 0; chunk < n_chunks; ++chunk) {
+#pragma omp task default(shared) firstprivate(chunk) if (n_chunks > 1)
+    func(chunk, chunk * chunk_size, std::min(n, (chunk + 1) * chunk_size));
+  }
+#pragma omp taskwait
+}
+
+/**
+ * @brief Stable LSD radix sort of values by the lowest n_bits of key(value),
+ * 8 bits per pass. Every pass histograms and scatters fixed chunks as
+ * concurrent tasks, so the result does not depend on the number of threads.
+ */
+template <typename T, typename KeyFunc>
+void RadixSort(vector<T> &values, int n_bits, const KeyFunc &key) {
+  constexpr int RADIX_BITS    = 8;
+  constexpr int N_BUCKETS     = 1 << RADIX_BITS;
+  constexpr size_t CHUNK_SIZE = 65536;
+  const size_t n              = values.size();
+  const size_t n_chunks       = (n + CHUNK_SIZE - 1) / CHUNK_SIZE;
+
+  vector<T> buffer(n);
+  vector<std::array<size_t, N_BUCKETS>> offsets(n_chunks);
+  for (int shift = 0; shift < n_bits; shift += RADIX_BITS) {
+    const auto digit = [&](const T &value) {
+      return static_cast<size_t>(key(value) >> shift) & (N_BUCKETS - 1);
+    };
+
+    ForEachChunk(n, CHUNK_SIZE, [&](size_t chunk, size_t begin, size_t end) {
+      offsets[chunk].fill(0);
+      for (size_t i = begin; i < end; ++i) ++offsets[chunk][digit(values[i])];
+    });
+
+    // Bucket-major, chunk-minor exclusive scan keeps the sort stable
+    size_t offset = 0;
+    for (int bucket = 0; bucket < N_BUCKETS; ++bucket) {
+      for (auto &chunk_offsets : offsets) {
+        const size_t count    = chunk_offsets[bucket];
+        chunk_offsets[bucket] = offset;
+        offset += count;
+      }
+    }
+
+    ForEachChunk(n, CHUNK_SIZE, [&](size_t chunk, size_t begin, size_t end) {
+      for (size_t i = begin; i < end; ++i)
+        buffer[offsets[chunk][digit(values[i])]++] = values[i];
+    });
+    values.swap(buffer);
+  }
+}
+
+/// Spread the lowest 21 bits of v such that there are two zeros between bits
+inline uint64_t ExpandBitsBy3(uint64_t v) {
+  v &= 0x1fffffULL;
+  v = (v | v << 32) & 0x001f00000000ffffULL;
+  v = (v | v << 16) & 0x001f0000ff0000ffULL;
+  v = (v | v << 8) & 0x100f00f00f00f00fULL;
+  v = (v | v << 4) & 0x10c30c30c30c30c3ULL;
+  v = (v | v << 2) & 0x1249249249249249ULL;
+  return v;
+}
+
+/// 63-bit Morton code of a point in [0, 1]^3, bit i splits the axis i % 3
+inline uint64_t EncodeMorton3(const Vec3f &p) {
+  constexpr Float SCALE = 1 << 21;
+  const auto quantize   = [](Float x) {
+    return static_cast<uint64_t>(std::clamp(x * SCALE, 0.0F, SCALE - 1));
+  };
+  return (ExpandBitsBy3(quantize(p.z)) << 2) |
+         (ExpandBitsBy3(quantize(p.y)) << 1) | ExpandBitsBy3(quantize(p.x));
+}
+}  // namespace detail_
+
+/**
+ * @brief Quality statistics of a built BVHTree, e.g. to justify the builder
+ * settings or to catch pathological assets early.
+ */
+struct BVHStats {
+  int n_interior_nodes{0};
+  int n_leaves{0};
+  int n_references{0};      ///<! data nodes referenced by the leaves
+  int max_depth{0};         ///<! of the deepest leaf, the root is at 0
+  Float sah_cost{0};        ///<! @see BVHTree::getSurfaceAreaCost
+  vector<int> leaf_depths;  ///<! leaf_depths[d]: number of leaves at depth d
+  vector<int> leaf_sizes;   ///<! leaf_sizes[n]: number of leaves of size n
+
+  std::string toString() const {
+    const auto histogram = [](const vector<int> &counts) {
+      std::ostringstream ss;
+      for (size_t i = 0; i < counts.size(); ++i)
+        if (counts[i] != 0) ss << format(" {}:{}", i, counts[i]);
+      return ss.str();
+    };
+
+    std::ostringstream ss;
+    ss << "BVHStats[\n"
+       << format("  interior nodes = {}\n", n_interior_nodes)
+       << format("  leaves         = {}\n", n_leaves)
+       << format("  references     = {}\n", n_references)
+       << format("  max depth      = {}\n", max_depth)
+       << format("  SAH cost       = {:.3f}\n", sah_cost)
+       << format("  leaf depths    ={}\n", histogram(leaf_depths))
+       << format("  leaf sizes     ={}\n", histogram(leaf_sizes)) << "]";
+    return ss.str();
+  }
+};
+
 // TODO: check derived class's type
 template <typename NodeType_>
 class BVHTree final {
@@ -40,12 +168,25 @@ public:
   // Context-local
   constexpr static int INVALID_INDEX = -1;
   constexpr static int CUTOFF_DEPTH  = 22;
+  constexpr static int STACK_SIZE    = 64;
+  static_assert(CUTOFF_DEPTH < STACK_SIZE, "traversal stack might overflow");
+
+  // Spans larger than this are built as concurrent OpenMP tasks
+  constexpr static int PARALLEL_BUILD_SIZE = 4096;
+  // Spans larger than this are binned by concurrent chunks, i.e. only the
+  // top levels, where a single span would otherwise serialize the build
+  constexpr static int PARALLEL_BINNING_SIZE = 65536;
+  constexpr static int PARALLEL_CHUNK_SIZE   = 16384;
 
   enum class EHeuristicProfile {
     EMedianHeuristic      = 0,  ///<! use centroid[depth%3]
     ESurfaceAreaHeuristic = 1,  ///<! use SAH (see PBRT)
+    ELinearHeuristic      = 2,  ///<! use Morton codes, i.e. LBVH (see PBRT)
   };
 
+  // The largest treelet the restructuring pass can optimize exhaustively
+  constexpr static int MAX_TREELET_SIZE = 7;
+
   // The actual node that represents the tree structure
   struct InternalNode {
     InternalNode() = default;
@@ -53,6 +194,7 @@ public:
         : span_left(span_left), span_right(span_right) {}
 
     bool is_leaf{false};
+    int axis{0};  // The split dimension of interior nodes
     IndexType left_index{INVALID_INDEX};
     IndexType right_index{INVALID_INDEX};
     IndexType span_left{INVALID_INDEX};
@@ -60,6 +202,30 @@ public:
     AABB aabb{};                          // The bounding box of the node
   };
 
+  // The compacted node used for traversal. Nodes are stored in depth-first
+  // order, so the first child of an interior node directly follows it and
+  // only the second one has to be addressed.
+  struct alignas(32) LinearNode {
+    Vec3f low_bnd{};
+    IndexType offset{INVALID_INDEX};  // leaf: first data node, else 2nd child
+    Vec3f upper_bnd{};
+    uint32_t packed{0};  // (number of data nodes << 2) | axis, 0 if interior
+
+    bool isLeaf() const { return (packed >> 2) != 0; }
+    IndexType getCount() const { return static_cast<IndexType>(packed >> 2); }
+    int getAxis() const { return static_cast<int>(packed & 3); }
+
+    /// Slab test against the current [t_min, t_max] of the ray
+    bool intersect(const Ray &ray) const {
+      const Vec3f t0 = (low_bnd - ray.origin) * ray.safe_inverse_direction;
+      const Vec3f t1 = (upper_bnd - ray.origin) * ray.safe_inverse_direction;
+      const Float t_enter = Max(ReduceMax(Min(t0, t1)), ray.t_min);
+      const Float t_exit  = Min(ReduceMin(Max(t0, t1)), ray.t_max);
+      return t_enter <= t_exit;
+    }
+  };
+  static_assert(sizeof(LinearNode) == 32, "LinearNode should fit 32 bytes");
+
   BVHTree()  = default;
   ~BVHTree() = default;
 
@@ -68,7 +234,14 @@ public:
 
   /// Nodes might be re-ordered
   void push_back(const NodeType &node) { nodes.push_back(node); }
-  const AABB &getAABB() const { return internal_nodes[root_index].aabb; }
+  AABB getAABB() const {
+    return {linear_nodes[0].low_bnd, linear_nodes[0].upper_bnd};
+  }
+
+  /// Read-only views of the built structure, e.g. to convert it into other
+  /// node layouts. Leaves address the data nodes in this (re-ordered) order.
+  const vector<NodeType> &getNodes() const { return nodes; }
+  const vector<LinearNode> &getLinearNodes() const { return linear_nodes; }
 
   /// reset build status
   void clear();
@@ -76,29 +249,141 @@ public:
   /// *Can* be executed not only once
   void build();
 
+  /// Adopt a tree built before, e.g. loaded from BVHCache, in place of
+  /// push_back() and build(). Return false if the linear nodes address
+  /// anything out of range or is deeper than CUTOFF_DEPTH, which the
+  /// traversal stacks are sized for. The tree is left empty in that case.
+  bool restore(vector<NodeType> in_nodes, vector<LinearNode> in_linear_nodes);
+
+  /// Depth of the deepest leaf, the root is at 0. Second children must
+  /// follow their parents, which restore() verifies and flatten() ensures
+  static int computeMaxDepth(const vector<LinearNode> &in_linear_nodes);
+
+  /// Recompute the bounds bottom-up after the data nodes moved, e.g. the
+  /// vertices of an animated mesh. The topology is kept, so the tree stays
+  /// correct but its quality might degrade, see update()
+  void refit();
+
+  /// refit(), then rebuild the subtrees whose normalized SAH cost grew by more
+  /// than max_degradation times since they were built. Return the number of
+  /// rebuilt subtrees. Data nodes are only re-ordered within those subtrees.
+  int update(Float max_degradation = 1.5F);
+
+  /// The SAH cost of the tree normalized by the area of the root, i.e. the
+  /// expected cost of a ray hitting the root. Lower is better.
+  Float getSurfaceAreaCost() const;
+
+  /// Depth and leaf size histograms and the SAH cost of the built tree
+  BVHStats getStats() const;
+
+  /// Builder selection, should be called before build()
+  void setHeuristicProfile(EHeuristicProfile profile) { hprofile = profile; }
+  EHeuristicProfile getHeuristicProfile() const { return hprofile; }
+  void setBuildSettings(const BVHBuildSettings &in_settings) {
+    settings = in_settings;
+  }
+  const BVHBuildSettings &getBuildSettings() const { return settings; }
+
+  /// The callback might shrink ray.t_max, which culls the remaining nodes
   template <typename Callback>
-  bool intersect(Ray &ray, Callback callback) const {
-    if (!is_built) return false;
-    return intersect(ray, root_index, callback);
+  bool intersect(Ray &ray, Callback callback) const;
+
+  /// Same as intersect(), but the callback receives the whole leaf as the
+  /// span [span_left, span_right) of getNodes() instead of each data node
+  template <typename LeafCallback>
+  bool intersectLeaves(Ray &ray, LeafCallback callback) const {
+    return traverse<false>(ray, callback);
   }
 
+  /// Any-hit query. The traversal terminates once a callback returns true
+  template <typename Callback>
+  bool occluded(const Ray &ray, Callback callback) const;
+
+  /// @see intersectLeaves and occluded
+  template <typename LeafCallback>
+  bool occludedLeaves(const Ray &ray, LeafCallback callback) const {
+    return traverse<true>(ray, callback);
+  }
+
+  /// Closest-hit query of a packet of up to RAY_PACKET_SIZE coherent rays,
+  /// the ones selected by mask. Each node is fetched once for the packet and
+  /// tested against the rays still active below it. The callback receives
+  /// (rays, mask of rays reaching the leaf, span_left, span_right) and
+  /// returns the mask of rays it hit, which is returned as a whole.
+  template <typename LeafCallback>
+  RayMask intersectPacketLeaves(
+      Ray *rays, RayMask mask, LeafCallback callback) const;
+
 private:
   EHeuristicProfile hprofile{EHeuristicProfile::EMedianHeuristic};
+  BVHBuildSettings settings{};
 
   bool is_built{false};
   IndexType root_index{INVALID_INDEX};
 
   vector<NodeType> nodes{};               /// The data nodes
   vector<InternalNode> internal_nodes{};  /// The internal nodes
+  vector<LinearNode> linear_nodes{};      /// The flattened internal nodes
+  /// Normalized SAH cost of every subtree as (re)built, aligned with
+  /// linear_nodes. Captured by the first refit(), as a reference for update()
+  vector<Float> reference_costs{};
 
-  /// Internal build
-  IndexType build(
-      int depth, const IndexType &span_left, const IndexType &span_right);
+  // Only used during build()
+  struct SubtreeInfo {
+    Float cost{0};  // unnormalized SAH cost
+    int height{0};  // 0 for leaves
+  };
+  vector<uint64_t> morton_codes{};      /// Aligned with nodes, if linear
+  vector<SubtreeInfo> subtree_infos{};  /// Aligned with internal_nodes
 
-  /// Internal intersect
-  template <typename Callback>
-  bool intersect(
-      Ray &ray, const IndexType &node_index, Callback callback) const;
+  /// Internal build, the subtree is written to internal_nodes starting from
+  /// slot, and occupies at most 2 * (span_right - span_left) - 1 slots
+  IndexType build(int depth, const IndexType &span_left,
+      const IndexType &span_right, const IndexType &slot);
+  IndexType buildLeaf(const IndexType &span_left, const IndexType &span_right,
+      const AABB &aabb, const IndexType &slot);
+
+  /// Fold map(partial, span_index) over [span_left, span_right). Large spans
+  /// are cut into fixed chunks, folded by concurrent tasks and then merged in
+  /// order, such that the result does not depend on the number of threads
+  template <typename T, typename MapFunc, typename MergeFunc>
+  T reduceSpan(const IndexType &span_left, const IndexType &span_right,
+      const T &init, MapFunc map, MergeFunc merge) const;
+
+  /// Binned SAH split, returns INVALID_INDEX if the span should be a leaf
+  IndexType splitSurfaceAreaHeuristic(const IndexType &span_left,
+      const IndexType &span_right, const AABB &aabb, int *split_dim);
+
+  /// Sort the nodes by the Morton codes of their centroids
+  void sortByMortonCode();
+
+  /// Split at the highest differing bit of the sorted Morton codes, returns
+  /// INVALID_INDEX if the span should be a leaf
+  IndexType splitMortonCode(const IndexType &span_left,
+      const IndexType &span_right, int *split_dim) const;
+
+  /// Optimize the treelets of the subtree bottom-up, see optimizeTreelet()
+  void restructure(int depth, const IndexType &node_index);
+
+  /// Find the SAH-optimal topology of the treelet below node_index among all
+  /// the ones over the same leaves (Karras and Aila, 2013), and apply it if it
+  /// is cheaper and within the traversal stack
+  void optimizeTreelet(int depth, const IndexType &node_index);
+
+  /// Convert the internal nodes into linear_nodes in depth-first order
+  IndexType flatten(const IndexType &node_index);
+
+  /// Normalized SAH cost of the subtree below each of the linear nodes
+  vector<Float> computeSubtreeCosts(
+      const vector<LinearNode> &in_linear_nodes) const;
+
+  /// Rebuild the subtree at linear_index over the same data nodes with the
+  /// current profile, and splice it into linear_nodes in place of the old one
+  void rebuildSubtree(int depth, const IndexType &linear_index);
+
+  /// The shared traversal loop of the closest-hit and any-hit queries
+  template <bool AnyHit, typename RayType, typename LeafCallback>
+  bool traverse(RayType &ray, LeafCallback callback) const;
 };
 
 /* ===================================================================== *
@@ -111,27 +396,299 @@ template <typename _>
 void BVHTree<_>::clear() {
   nodes.clear();
   internal_nodes.clear();
+  linear_nodes.clear();
+  reference_costs.clear();
   is_built = false;
 }
 
 template <typename _>
 void BVHTree<_>::build() {
   if (is_built) return;
-  // pre-allocate memory
-  internal_nodes.reserve(2 * nodes.size());
-  root_index = build(0, 0, nodes.size());
-  is_built   = true;
+  // A binary tree over n data nodes has at most 2n - 1 internal nodes. Each
+  // subtree owns a fixed range of slots, so the tasks of the parallel build
+  // never synchronize, and the result is identical to a serial build.
+  internal_nodes.assign(
+      nodes.empty() ? 0 : 2 * nodes.size() - 1, InternalNode());
+
+#pragma omp parallel if (nodes.size() >= PARALLEL_BUILD_SIZE)
+#pragma omp single
+  {
+    if (hprofile == EHeuristicProfile::ELinearHeuristic) sortByMortonCode();
+    root_index = build(0, 0, nodes.size(), 0);
+
+    if (settings.treelet_size >= 3 && root_index != INVALID_INDEX) {
+      subtree_infos.assign(internal_nodes.size(), SubtreeInfo());
+      restructure(0, root_index);
+    }
+  }
+  morton_codes.clear();
+  morton_codes.shrink_to_fit();
+  subtree_infos.clear();
+  subtree_infos.shrink_to_fit();
+
+  // The pointer-chasing tree is only needed during construction
+  linear_nodes.clear();
+  linear_nodes.reserve(internal_nodes.size());
+  if (root_index != INVALID_INDEX) flatten(root_index);
+  linear_nodes.shrink_to_fit();
+  internal_nodes.clear();
+  internal_nodes.shrink_to_fit();
+  is_built = true;
+}
+
+template <typename _>
+bool BVHTree<_>::restore(
+    vector<NodeType> in_nodes, vector<LinearNode> in_linear_nodes) {
+  clear();
+  const auto n_nodes        = static_cast<IndexType>(in_nodes.size());
+  const auto n_linear_nodes = static_cast<IndexType>(in_linear_nodes.size());
+  for (IndexType i = 0; i < n_linear_nodes; ++i) {
+    const auto &node = in_linear_nodes[i];
+    const bool valid = node.isLeaf()
+                         ? node.offset >= 0 && node.getCount() <= n_nodes &&
+                               node.offset <= n_nodes - node.getCount()
+                         : node.offset > i + 1 && node.offset < n_linear_nodes;
+    if (!valid) return false;
+  }
+  if (computeMaxDepth(in_linear_nodes) > CUTOFF_DEPTH) return false;
+
+  nodes        = std::move(in_nodes);
+  linear_nodes = std::move(in_linear_nodes);
+  is_built     = true;
+  return true;
+}
+
+template <typename _>
+int BVHTree<_>::computeMaxDepth(const vector<LinearNode> &in_linear_nodes) {
+  // Both children follow their parent, so one forward sweep settles depths
+  vector<int> depths(in_linear_nodes.size(), 0);
+  int max_depth = 0;
+  for (size_t i = 0; i < in_linear_nodes.size(); ++i) {
+    const auto &node = in_linear_nodes[i];
+    max_depth        = std::max(max_depth, depths[i]);
+    if (node.isLeaf()) continue;
+    depths[i + 1]       = std::max(depths[i + 1], depths[i] + 1);
+    depths[node.offset] = std::max(depths[node.offset], depths[i] + 1);
+  }
+  return max_depth;
+}
+
+template <typename _>
+void BVHTree<_>::refit() {
+  if (reference_costs.size() != linear_nodes.size())
+    reference_costs = computeSubtreeCosts(linear_nodes);
+
+  // Leaves dominate, as only they read the data nodes, and are independent
+  const auto n_linear_nodes = static_cast<IndexType>(linear_nodes.size());
+#pragma omp parallel for schedule(dynamic, 1024) \
+    if (n_linear_nodes >= PARALLEL_BUILD_SIZE)
+  for (IndexType i = 0; i < n_linear_nodes; ++i) {
+    auto &node = linear_nodes[i];
+    if (!node.isLeaf()) continue;
+    AABB aabb;
+    for (IndexType span_index = node.offset;
+         span_index < node.offset + node.getCount(); ++span_index)
+      aabb.unionWith(nodes[span_index].getAABB());
+    node.low_bnd   = aabb.low_bnd;
+    node.upper_bnd = aabb.upper_bnd;
+  }
+
+  // Children are stored after their parent, so a reverse sweep visits them
+  // first. This pass only merges two boxes per node and is left serial.
+  for (IndexType i = n_linear_nodes - 1; i >= 0; --i) {
+    auto &node = linear_nodes[i];
+    if (node.isLeaf()) continue;
+    const auto &left  = linear_nodes[i + 1];
+    const auto &right = linear_nodes[node.offset];
+    node.low_bnd      = Min(left.low_bnd, right.low_bnd);
+    node.upper_bnd    = Max(left.upper_bnd, right.upper_bnd);
+  }
+}
+
+template <typename _>
+int BVHTree<_>::update(Float max_degradation) {
+  if (linear_nodes.empty()) return 0;
+  refit();
+  const vector<Float> costs = computeSubtreeCosts(linear_nodes);
+  const auto degradation    = [&](IndexType index) {
+    return linear_nodes[index].isLeaf() || reference_costs[index] <= 0
+             ? 1.0F
+             : costs[index] / reference_costs[index];
+  };
+
+  // Rebuild where the degradation peaks. Above a damaged region, it is diluted
+  // by the intact siblings, while across a damaged region, it compounds over
+  // the levels. The candidates are disjoint subtrees.
+  vector<std::pair<int, IndexType>> candidates;  // (depth, linear index)
+  vector<std::pair<int, IndexType>> stack{{0, 0}};
+  while (!stack.empty()) {
+    const auto [depth, index] = stack.back();
+    stack.pop_back();
+    if (linear_nodes[index].isLeaf()) continue;
+    if (degradation(index) <= max_degradation) continue;
+
+    const IndexType left_index  = index + 1;
+    const IndexType right_index = linear_nodes[index].offset;
+    if (degradation(index) >
+        std::max(degradation(left_index), degradation(right_index))) {
+      candidates.emplace_back(depth, index);
+    } else {
+      stack.emplace_back(depth + 1, right_index);
+      stack.emplace_back(depth + 1, left_index);
+    }
+  }
+
+  // Splicing a subtree only moves the nodes after it, so the candidates in
+  // front stay valid
+  std::sort(candidates.begin(), candidates.end(),
+      [](const auto &a, const auto &b) { return a.second > b.second; });
+  for (const auto &[depth, index] : candidates) rebuildSubtree(depth, index);
+  return static_cast<int>(candidates.size());
+}
+
+template <typename _>
+Float BVHTree<_>::getSurfaceAreaCost() const {
+  return linear_nodes.empty() ? 0 : computeSubtreeCosts(linear_nodes)[0];
+}
+
+template <typename _>
+BVHStats BVHTree<_>::getStats() const {
+  BVHStats stats;
+  if (linear_nodes.empty()) return stats;
+  stats.sah_cost = getSurfaceAreaCost();
+
+  vector<std::pair<IndexType, int>> stack{{0, 0}};  // (linear index, depth)
+  while (!stack.empty()) {
+    const auto [index, depth] = stack.back();
+    stack.pop_back();
+    const auto &node = linear_nodes[index];
+    if (!node.isLeaf()) {
+      ++stats.n_interior_nodes;
+      stack.emplace_back(node.offset, depth + 1);
+      stack.emplace_back(index + 1, depth + 1);
+      continue;
+    }
+
+    const IndexType count = node.getCount();
+    ++stats.n_leaves;
+    stats.n_references += count;
+    stats.max_depth = std::max(stats.max_depth, depth);
+    if (stats.leaf_depths.size() <= static_cast<size_t>(depth))
+      stats.leaf_depths.resize(depth + 1);
+    if (stats.leaf_sizes.size() <= static_cast<size_t>(count))
+      stats.leaf_sizes.resize(count + 1);
+    ++stats.leaf_depths[depth];
+    ++stats.leaf_sizes[count];
+  }
+
+  return stats;
+}
+
+template <typename _>
+vector<Float> BVHTree<_>::computeSubtreeCosts(
+    const vector<LinearNode> &in_linear_nodes) const {
+  // Unnormalized costs are summed bottom-up, see refit()
+  const auto n_linear_nodes = static_cast<IndexType>(in_linear_nodes.size());
+  vector<Float> costs(n_linear_nodes);
+  for (IndexType i = n_linear_nodes - 1; i >= 0; --i) {
+    const auto &node = in_linear_nodes[i];
+    const Float area = AABB(node.low_bnd, node.upper_bnd).getSurfaceArea();
+    costs[i] = node.isLeaf()
+                 ? settings.intersection_cost * node.getCount() * area
+                 : settings.traversal_cost * area + costs[i + 1] +
+                       costs[node.offset];
+  }
+
+  // Children are normalized after their parent
+  for (IndexType i = 0; i < n_linear_nodes; ++i) {
+    const auto &node = in_linear_nodes[i];
+    const Float area = AABB(node.low_bnd, node.upper_bnd).getSurfaceArea();
+    costs[i]         = area > 0 ? costs[i] / area : 0;
+  }
+
+  return costs;
+}
+
+template <typename _>
+void BVHTree<_>::rebuildSubtree(int depth, const IndexType &linear_index) {
+  // The subtree occupies [linear_index, linear_end) of the linear nodes, and
+  // its leaves the data nodes [span_left, span_right), both contiguous in
+  // depth-first order
+  IndexType linear_end = linear_index;
+  IndexType span_left  = static_cast<IndexType>(nodes.size());
+  IndexType span_right = 0;
+  for (IndexType pending = 1; pending > 0; ++linear_end) {
+    const auto &node = linear_nodes[linear_end];
+    if (node.isLeaf()) {
+      span_left  = std::min(span_left, node.offset);
+      span_right = std::max(span_right, node.offset + node.getCount());
+      --pending;
+    } else {
+      ++pending;
+    }
+  }
+
+  // Morton codes are only available during build()
+  const EHeuristicProfile profile = hprofile;
+  if (hprofile == EHeuristicProfile::ELinearHeuristic)
+    hprofile = EHeuristicProfile::ESurfaceAreaHeuristic;
+  internal_nodes.assign(2 * (span_right - span_left) - 1, InternalNode());
+  IndexType subtree_root = INVALID_INDEX;
+#pragma omp parallel if (span_right - span_left >= PARALLEL_BUILD_SIZE)
+#pragma omp single
+  {
+    subtree_root = build(depth, span_left, span_right, 0);
+    if (settings.treelet_size >= 3) {
+      subtree_infos.assign(internal_nodes.size(), SubtreeInfo());
+      restructure(depth, subtree_root);
+    }
+  }
+  hprofile = profile;
+  subtree_infos.clear();
+  subtree_infos.shrink_to_fit();
+
+  // Flatten into a separate array, whose interior offsets are then relative
+  // to linear_index
+  vector<LinearNode> subtree;
+  linear_nodes.swap(subtree);
+  flatten(subtree_root);
+  linear_nodes.swap(subtree);
+  internal_nodes.clear();
+  internal_nodes.shrink_to_fit();
+  const vector<Float> subtree_costs = computeSubtreeCosts(subtree);
+  for (auto &node : subtree)
+    if (!node.isLeaf()) node.offset += linear_index;
+
+  // Shift whatever points past the old subtree, i.e. the nodes after it and
+  // the second children of its ancestors
+  const IndexType shift =
+      static_cast<IndexType>(subtree.size()) - (linear_end - linear_index);
+  for (auto &node : linear_nodes)
+    if (!node.isLeaf() && node.offset >= linear_end) node.offset += shift;
+
+  linear_nodes.erase(linear_nodes.begin() + linear_index,
+      linear_nodes.begin() + linear_end);
+  linear_nodes.insert(
+      linear_nodes.begin() + linear_index, subtree.begin(), subtree.end());
+  reference_costs.erase(reference_costs.begin() + linear_index,
+      reference_costs.begin() + linear_end);
+  reference_costs.insert(reference_costs.begin() + linear_index,
+      subtree_costs.begin(), subtree_costs.end());
 }
 
 template <typename _>
-typename BVHTree<_>::IndexType BVHTree<_>::build(
-    int depth, const IndexType &span_left, const IndexType &span_right) {
+typename BVHTree<_>::IndexType BVHTree<_>::build(int depth,
+    const IndexType &span_left, const IndexType &span_right,
+    const IndexType &slot) {
   if (span_left >= span_right) return INVALID_INDEX;
 
   // early calculate bound
-  AABB prebuilt_aabb;
-  for (IndexType span_index = span_left; span_index < span_right; ++span_index)
-    prebuilt_aabb.unionWith(nodes[span_index].getAABB());
+  const AABB prebuilt_aabb = reduceSpan(
+      span_left, span_right, AABB(),
+      [&](AABB &aabb, IndexType span_index) {
+        aabb.unionWith(nodes[span_index].getAABB());
+      },
+      [](AABB &aabb, const AABB &partial) { aabb.unionWith(partial); });
 
   // TODO(HW3): setup the stop criteria
   //
@@ -144,15 +701,8 @@ typename BVHTree<_>::IndexType BVHTree<_>::build(
   // @see span_right: The right index of the current span
   //
   // /* if ( */ UNIMPLEMENTED; /* ) */
-  if (depth >= CUTOFF_DEPTH || (span_right - span_left) <= 1) {
-    // create leaf node
-    const auto &node = nodes[span_left];
-    InternalNode result(span_left, span_right);
-    result.is_leaf = true;
-    result.aabb    = prebuilt_aabb;
-    internal_nodes.push_back(result);
-    return internal_nodes.size() - 1;
-  }
+  if (depth >= CUTOFF_DEPTH || (span_right - span_left) <= 1)
+    return buildLeaf(span_left, span_right, prebuilt_aabb, slot);
 
   // You'll notice that the implementation here is different from the KD-Tree
   // ones, which re-use the node for both data-storing and organizing the real
@@ -162,7 +712,7 @@ typename BVHTree<_>::IndexType BVHTree<_>::build(
   InternalNode result(span_left, span_right);
 
   // const int &dim = depth % 3;
-  const int &dim  = ArgMax(prebuilt_aabb.getExtent());
+  int dim         = ArgMax(prebuilt_aabb.getExtent());
   IndexType count = span_right - span_left;
   IndexType split = INVALID_INDEX;
 
@@ -205,48 +755,529 @@ use_median_heuristic:
     // distributed random ray passing through B will also pass through A is the
     // ratio of their surface areas"
 
-    // TODO (BONUS): implement Surface area heuristic here
-    //
-    // You can then set @see BVHTree::hprofile to ESurfaceAreaHeuristic to
-    // enable this feature.
-    // UNIMPLEMENTED;
+    // Instead of sorting, centroids are scattered into a fixed number of
+    // bins along the widest centroid axis and only the bin boundaries are
+    // evaluated, which keeps the build O(n) per level.
+    split =
+        splitSurfaceAreaHeuristic(span_left, span_right, prebuilt_aabb, &dim);
+    if (split == INVALID_INDEX)
+      return buildLeaf(span_left, span_right, prebuilt_aabb, slot);
+    // Degenerated partition, e.g. all centroids coincide
+    if (split == span_left || split == span_right) goto use_median_heuristic;
+  } else if (hprofile == EHeuristicProfile::ELinearHeuristic) {
+    // The nodes are sorted already, and must not be re-ordered
+    split = splitMortonCode(span_left, span_right, &dim);
+    if (split == INVALID_INDEX)
+      return buildLeaf(span_left, span_right, prebuilt_aabb, slot);
   }
 
-  // Build the left and right subtree
-  result.left_index  = build(depth + 1, span_left, split);
-  result.right_index = build(depth + 1, split, span_right);
+  // Build the left and right subtree. The left one takes the slots right
+  // after this node, the right one those after the left one.
+  const IndexType left_slot  = slot + 1;
+  const IndexType right_slot = slot + 2 * (split - span_left);
+#pragma omp task default(shared) if (split - span_left >= PARALLEL_BUILD_SIZE)
+  result.left_index = build(depth + 1, span_left, split, left_slot);
+  result.right_index = build(depth + 1, split, span_right, right_slot);
+#pragma omp taskwait
 
   // Iterative merge
   result.aabb = prebuilt_aabb;
+  result.axis = dim;
 
-  internal_nodes.push_back(result);
-  return internal_nodes.size() - 1;
+  internal_nodes[slot] = result;
+  return slot;
 }
 
 template <typename _>
-template <typename Callback>
-bool BVHTree<_>::intersect(
-    Ray &ray, const IndexType &node_index, Callback callback) const {
-  bool result      = false;
-  const auto &node = internal_nodes[node_index];
-
-  // Perform the actual pruning
-  Float t_in, t_out;
-  if (!node.aabb.intersect(ray, &t_in, &t_out)) return result;
+typename BVHTree<_>::IndexType BVHTree<_>::buildLeaf(
+    const IndexType &span_left, const IndexType &span_right,
+    const AABB &aabb, const IndexType &slot) {
+  InternalNode result(span_left, span_right);
+  result.is_leaf       = true;
+  result.aabb          = aabb;
+  internal_nodes[slot] = result;
+  return slot;
+}
 
-  if (node.is_leaf) {
-    for (IndexType span_index = node.span_left; span_index < node.span_right;
+template <typename _>
+template <typename T, typename MapFunc, typename MergeFunc>
+T BVHTree<_>::reduceSpan(const IndexType &span_left,
+    const IndexType &span_right, const T &init, MapFunc map,
+    MergeFunc merge) const {
+  const IndexType count = span_right - span_left;
+  if (count < PARALLEL_BINNING_SIZE) {
+    T result = init;
+    for (IndexType span_index = span_left; span_index < span_right;
          ++span_index)
-      result |= callback(ray, nodes[span_index].getData());
+      map(result, span_index);
     return result;
+  }
+
+  const IndexType n_chunks =
+      (count + PARALLEL_CHUNK_SIZE - 1) / PARALLEL_CHUNK_SIZE;
+  vector<T> partials(n_chunks, init);
+  for (IndexType chunk = 0; chunk < n_chunks; ++chunk) {
+#pragma omp task default(shared) firstprivate(chunk)
+    {
+      const IndexType chunk_left = span_left + chunk * PARALLEL_CHUNK_SIZE;
+      const IndexType chunk_right =
+          std::min(chunk_left + PARALLEL_CHUNK_SIZE, span_right);
+      for (IndexType span_index = chunk_left; span_index < chunk_right;
+           ++span_index)
+        map(partials[chunk], span_index);
+    }
+  }
+#pragma omp taskwait
+
+  T result = init;
+  for (const auto &partial : partials) merge(result, partial);
+  return result;
+}
+
+template <typename _>
+void BVHTree<_>::sortByMortonCode() {
+  struct MortonNode {
+    uint64_t code;
+    IndexType index;
+  };
+
+  const IndexType n_nodes  = nodes.size();
+  const AABB centroid_aabb = reduceSpan(
+      0, n_nodes, AABB(),
+      [&](AABB &centroids, IndexType span_index) {
+        centroids.unionWith(nodes[span_index].getAABB().getCenter());
+      },
+      [](AABB &centroids, const AABB &partial) {
+        centroids.unionWith(partial);
+      });
+
+  // Degenerated axes are mapped to 0
+  const Vec3f extent = centroid_aabb.getExtent();
+  const Vec3f scale(extent.x > 0 ? 1 / extent.x : 0,
+      extent.y > 0 ? 1 / extent.y : 0, extent.z > 0 ? 1 / extent.z : 0);
+
+  vector<MortonNode> morton_nodes(n_nodes);
+  detail_::ForEachChunk(n_nodes, PARALLEL_CHUNK_SIZE,
+      [&](size_t, size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+          const Vec3f centroid = nodes[i].getAABB().getCenter();
+          const Vec3f unit     = (centroid - centroid_aabb.low_bnd) * scale;
+          morton_nodes[i]      = {
+              detail_::EncodeMorton3(unit), static_cast<IndexType>(i)};
+        }
+      });
+  detail_::RadixSort(morton_nodes, 63,
+      [](const MortonNode &node) { return node.code; });
+
+  vector<NodeType> sorted_nodes;
+  sorted_nodes.reserve(n_nodes);
+  morton_codes.resize(n_nodes);
+  for (IndexType i = 0; i < n_nodes; ++i) {
+    sorted_nodes.push_back(nodes[morton_nodes[i].index]);
+    morton_codes[i] = morton_nodes[i].code;
+  }
+  nodes.swap(sorted_nodes);
+}
+
+template <typename _>
+typename BVHTree<_>::IndexType BVHTree<_>::splitMortonCode(
+    const IndexType &span_left, const IndexType &span_right,
+    int *split_dim) const {
+  const IndexType count = span_right - span_left;
+  if (count <= settings.max_leaf_size) return INVALID_INDEX;
+
+  // Coincident centroids cannot be told apart, so simply halve the span
+  const uint64_t diff =
+      morton_codes[span_left] ^ morton_codes[span_right - 1];
+  if (diff == 0) return span_left + count / 2;
+
+  int bit = 63;
+  while (!(diff >> bit & 1)) --bit;
+
+  // Codes are sorted, so the ones with the bit set form a suffix
+  *split_dim = bit % 3;
+  const auto *middle = std::partition_point(morton_codes.data() + span_left,
+      morton_codes.data() + span_right,
+      [bit](uint64_t code) { return !(code >> bit & 1); });
+  return static_cast<IndexType>(middle - morton_codes.data());
+}
+
+template <typename _>
+void BVHTree<_>::restructure(int depth, const IndexType &node_index) {
+  const auto &node      = internal_nodes[node_index];
+  const Float area      = node.aabb.getSurfaceArea();
+  const IndexType count = node.span_right - node.span_left;
+  if (node.is_leaf) {
+    subtree_infos[node_index] = {settings.intersection_cost * count * area, 0};
+    return;
+  }
+
+  // Treelets only involve their own subtree, so siblings are independent.
+  // Note that the spans of interior nodes are stale afterwards, which is fine
+  // since flatten() only reads those of leaves.
+#pragma omp task default(shared) if (count >= PARALLEL_BUILD_SIZE)
+  restructure(depth + 1, node.left_index);
+  restructure(depth + 1, node.right_index);
+#pragma omp taskwait
+
+  const auto &left  = subtree_infos[node.left_index];
+  const auto &right = subtree_infos[node.right_index];
+  subtree_infos[node_index] = {
+      settings.traversal_cost * area + left.cost + right.cost,
+      1 + std::max(left.height, right.height)};
+  optimizeTreelet(depth, node_index);
+}
+
+template <typename _>
+void BVHTree<_>::optimizeTreelet(int depth, const IndexType &node_index) {
+  constexpr int N_SUBSETS = 1 << MAX_TREELET_SIZE;
+  const int treelet_size  = std::min(settings.treelet_size, MAX_TREELET_SIZE);
+
+  // Grow the treelet by opening the interior leaf with the largest area
+  IndexType leaves[MAX_TREELET_SIZE], interiors[MAX_TREELET_SIZE - 1];
+  int n_leaves = 0, n_interiors = 0;
+  interiors[n_interiors++] = node_index;
+  leaves[n_leaves++]       = internal_nodes[node_index].left_index;
+  leaves[n_leaves++]       = internal_nodes[node_index].right_index;
+  while (n_leaves < treelet_size) {
+    int best_leaf   = -1;
+    Float best_area = -1;
+    for (int i = 0; i < n_leaves; ++i) {
+      const auto &leaf = internal_nodes[leaves[i]];
+      if (leaf.is_leaf) continue;
+
+      const Float area = leaf.aabb.getSurfaceArea();
+      if (area > best_area) {
+        best_area = area;
+        best_leaf = i;
+      }
+    }
+
+    if (best_leaf < 0) break;
+    const auto &opened       = internal_nodes[leaves[best_leaf]];
+    interiors[n_interiors++] = leaves[best_leaf];
+    leaves[best_leaf]        = opened.left_index;
+    leaves[n_leaves++]       = opened.right_index;
+  }
+  if (n_leaves < 3) return;
+
+  // Dynamic programming over all subsets of the leaves, where the optimal
+  // cost of a subset is that of its best 2-partition plus its own traversal
+  AABB aabbs[N_SUBSETS];
+  SubtreeInfo best[N_SUBSETS];
+  int partitions[N_SUBSETS];
+  const int full = (1 << n_leaves) - 1;
+  for (int subset = 1; subset <= full; ++subset) {
+    const int lowest = subset & -subset;
+    if (subset == lowest) {
+      int leaf = 0;
+      while (!(subset >> leaf & 1)) ++leaf;
+      aabbs[subset] = internal_nodes[leaves[leaf]].aabb;
+      best[subset]  = subtree_infos[leaves[leaf]];
+      continue;
+    }
+
+    aabbs[subset] = aabbs[subset ^ lowest];
+    aabbs[subset].unionWith(aabbs[lowest]);
+
+    // Only enumerate the partitions holding the lowest leaf on the left, the
+    // others are mirrored
+    best[subset].cost = Float_INF;
+    for (int part = (subset - 1) & subset; part != 0;
+         part     = (part - 1) & subset) {
+      if (!(part & lowest)) continue;
+      const Float cost = best[part].cost + best[subset ^ part].cost;
+      if (cost < best[subset].cost) {
+        best[subset].cost  = cost;
+        partitions[subset] = part;
+      }
+    }
+
+    const int part = partitions[subset];
+    best[subset].cost +=
+        settings.traversal_cost * aabbs[subset].getSurfaceArea();
+    best[subset].height =
+        1 + std::max(best[part].height, best[subset ^ part].height);
+  }
+
+  // Never grow the tree beyond CUTOFF_DEPTH, which bounds the traversal
+  // stacks, e.g. the one of WideBVHAccel
+  const auto &current = subtree_infos[node_index];
+  if (!(best[full].cost < current.cost) ||
+      depth + best[full].height > CUTOFF_DEPTH)
+    return;
+
+  // Re-emit the treelet, re-using its interior nodes. The root keeps its slot
+  // since interiors[0] is taken first.
+  int n_emitted   = 0;
+  const auto emit = [&](const auto &self, int subset) -> IndexType {
+    if ((subset & (subset - 1)) == 0) {
+      int leaf = 0;
+      while (!(subset >> leaf & 1)) ++leaf;
+      return leaves[leaf];
+    }
+
+    const IndexType slot = interiors[n_emitted++];
+    IndexType left       = self(self, partitions[subset]);
+    IndexType right      = self(self, subset ^ partitions[subset]);
+
+    // Order the children along the axis separating them the most, which the
+    // traversal relies on to visit the near child first
+    const Vec3f offset = internal_nodes[right].aabb.getCenter() -
+                         internal_nodes[left].aabb.getCenter();
+    const int axis = ArgMax(Abs(offset));
+    if (offset[axis] < 0) std::swap(left, right);
+
+    auto &interior       = internal_nodes[slot];
+    interior.is_leaf     = false;
+    interior.axis        = axis;
+    interior.left_index  = left;
+    interior.right_index = right;
+    interior.aabb        = aabbs[subset];
+    subtree_infos[slot]  = best[subset];
+    return slot;
+  };
+  emit(emit, full);
+}
+
+template <typename _>
+typename BVHTree<_>::IndexType BVHTree<_>::splitSurfaceAreaHeuristic(
+    const IndexType &span_left, const IndexType &span_right,
+    const AABB &aabb, int *split_dim) {
+  struct Bin {
+    IndexType count{0};
+    AABB aabb{};
+  };
+
+  const IndexType count = span_right - span_left;
+  const int n_bins      = std::max(settings.sah_bins, 2);
+
+  const AABB centroid_aabb = reduceSpan(
+      span_left, span_right, AABB(),
+      [&](AABB &centroids, IndexType span_index) {
+        centroids.unionWith(nodes[span_index].getAABB().getCenter());
+      },
+      [](AABB &centroids, const AABB &partial) {
+        centroids.unionWith(partial);
+      });
+
+  const int dim       = ArgMax(centroid_aabb.getExtent());
+  const Float low     = centroid_aabb.low_bnd[dim];
+  const Float extent  = centroid_aabb.getDist(dim);
+  const bool can_leaf = count <= settings.max_leaf_size;
+  if (!(extent > 0)) return can_leaf ? INVALID_INDEX : span_left;
+
+  const auto to_bin = [&](const AABB &node_aabb) {
+    const int bin =
+        static_cast<int>(n_bins * (node_aabb.getCenter()[dim] - low) / extent);
+    return std::clamp(bin, 0, n_bins - 1);
+  };
+
+  // Counts and bounds are merged exactly, regardless of the chunking
+  const vector<Bin> bins = reduceSpan(
+      span_left, span_right, vector<Bin>(n_bins),
+      [&](vector<Bin> &partial, IndexType span_index) {
+        const AABB node_aabb = nodes[span_index].getAABB();
+        auto &bin            = partial[to_bin(node_aabb)];
+        ++bin.count;
+        bin.aabb.unionWith(node_aabb);
+      },
+      [&](vector<Bin> &merged, const vector<Bin> &partial) {
+        for (int i = 0; i < n_bins; ++i) {
+          merged[i].count += partial[i].count;
+          merged[i].aabb.unionWith(partial[i].aabb);
+        }
+      });
+
+  // Sweep from the right to gather the suffix areas, then from the left to
+  // evaluate cost(split after bin i) = C_t + C_i * (N_l A_l + N_r A_r) / A
+  vector<Float> right_area(n_bins, 0);
+  AABB right_aabb;
+  for (int i = n_bins - 1; i > 0; --i) {
+    right_aabb.unionWith(bins[i].aabb);
+    right_area[i] = right_aabb.getSurfaceArea();
+  }
+
+  const Float area  = aabb.getSurfaceArea();
+  const Float scale = area > 0 ? settings.intersection_cost / area
+                               : settings.intersection_cost;
+
+  int best_bin    = -1;
+  Float best_cost = Float_INF;
+  AABB left_aabb;
+  IndexType left_count = 0;
+  for (int i = 0; i < n_bins - 1; ++i) {
+    left_aabb.unionWith(bins[i].aabb);
+    left_count += bins[i].count;
+    const IndexType right_count = count - left_count;
+    if (left_count == 0 || right_count == 0) continue;
+
+    const Float cost = settings.traversal_cost +
+                       scale * (left_count * left_aabb.getSurfaceArea() +
+                                   right_count * right_area[i + 1]);
+    if (cost < best_cost) {
+      best_cost = cost;
+      best_bin  = i;
+    }
+  }
+
+  // Splitting does not pay off, or there is nothing to split at all
+  const Float leaf_cost = settings.intersection_cost * count;
+  if (can_leaf && (best_bin < 0 || leaf_cost <= best_cost))
+    return INVALID_INDEX;
+  if (best_bin < 0) return span_left;
+
+  *split_dim = dim;
+  auto *middle = std::partition(nodes.data() + span_left,
+      nodes.data() + span_right,
+      [&](const NodeType &node) { return to_bin(node.getAABB()) <= best_bin; });
+  return static_cast<IndexType>(middle - nodes.data());
+}
+
+template <typename _>
+typename BVHTree<_>::IndexType BVHTree<_>::flatten(
+    const IndexType &node_index) {
+  const auto &node             = internal_nodes[node_index];
+  const IndexType linear_index = linear_nodes.size();
+  linear_nodes.emplace_back();
+
+  LinearNode result;
+  result.low_bnd   = node.aabb.low_bnd;
+  result.upper_bnd = node.aabb.upper_bnd;
+  if (node.is_leaf) {
+    result.offset = node.span_left;
+    result.packed = static_cast<uint32_t>(node.span_right - node.span_left)
+                 << 2;
   } else {
-    // Recurse
-    if (node.left_index != INVALID_INDEX)
-      result |= intersect(ray, node.left_index, callback);
-    if (node.right_index != INVALID_INDEX)
-      result |= intersect(ray, node.right_index, callback);
-    return result;
+    // Interior nodes always have two children, see build()
+    flatten(node.left_index);
+    result.offset = flatten(node.right_index);
+    result.packed = static_cast<uint32_t>(node.axis);
+  }
+
+  linear_nodes[linear_index] = result;
+  return linear_index;
+}
+
+template <typename _>
+template <typename Callback>
+bool BVHTree<_>::intersect(Ray &ray, Callback callback) const {
+  return intersectLeaves(ray,
+      [&](Ray &local_ray, IndexType span_left, IndexType span_right) {
+        bool result = false;
+        for (IndexType span_index = span_left; span_index < span_right;
+             ++span_index)
+          result |= callback(local_ray, nodes[span_index].getData());
+        return result;
+      });
+}
+
+template <typename _>
+template <typename Callback>
+bool BVHTree<_>::occluded(const Ray &ray, Callback callback) const {
+  return occludedLeaves(ray,
+      [&](const Ray &local_ray, IndexType span_left, IndexType span_right) {
+        for (IndexType span_index = span_left; span_index < span_right;
+             ++span_index)
+          if (callback(local_ray, nodes[span_index].getData())) return true;
+        return false;
+      });
+}
+
+template <typename _>
+template <bool AnyHit, typename RayType, typename LeafCallback>
+bool BVHTree<_>::traverse(RayType &ray, LeafCallback callback) const {
+  if (!is_built || linear_nodes.empty()) return false;
+
+  bool result              = false;
+  const bool dir_is_neg[3] = {
+      ray.direction.x < 0, ray.direction.y < 0, ray.direction.z < 0};
+  TraversalStats *stats = CurrentTraversalStats();
+
+  // Nodes to be visited, the far child is deferred
+  IndexType stack[STACK_SIZE];
+  int stack_size          = 0;
+  IndexType current_index = 0;
+  while (true) {
+    const auto &node = linear_nodes[current_index];
+    if (stats != nullptr) ++stats->node_visits;
+    if (node.intersect(ray)) {
+      if (!node.isLeaf()) {
+        // Visit the near child first so that t_max shrinks early
+        if (dir_is_neg[node.getAxis()]) {
+          stack[stack_size++] = current_index + 1;
+          current_index       = node.offset;
+        } else {
+          stack[stack_size++] = node.offset;
+          current_index       = current_index + 1;
+        }
+        continue;
+      }
+
+      if (stats != nullptr) stats->primitive_tests += node.getCount();
+      result |= callback(ray, node.offset, node.offset + node.getCount());
+      if constexpr (AnyHit) {
+        if (result) return true;
+      }
+    }
+
+    if (stack_size == 0) break;
+    current_index = stack[--stack_size];
   }
+
+  return result;
+}
+
+template <typename _>
+template <typename LeafCallback>
+RayMask BVHTree<_>::intersectPacketLeaves(
+    Ray *rays, RayMask mask, LeafCallback callback) const {
+  if (!is_built || linear_nodes.empty() || mask == 0) return 0;
+
+  // The traversal order follows the first active ray, which is as good as
+  // any other one for a coherent packet
+  int leader = 0;
+  while (!IsRayActive(mask, leader)) ++leader;
+  const bool dir_is_neg[3] = {rays[leader].direction.x < 0,
+      rays[leader].direction.y < 0, rays[leader].direction.z < 0};
+
+  // Nodes to be visited, together with the rays that reached them
+  struct StackEntry {
+    IndexType index;
+    RayMask mask;
+  };
+  StackEntry stack[STACK_SIZE];
+  int stack_size = 0;
+  StackEntry current{0, mask};
+  RayMask result = 0;
+  while (true) {
+    const auto &node = linear_nodes[current.index];
+    RayMask active   = 0;
+    for (int i = 0; i < RAY_PACKET_SIZE; ++i)
+      if (IsRayActive(current.mask, i) && node.intersect(rays[i]))
+        active |= RayMask(1) << i;
+
+    if (active != 0) {
+      if (!node.isLeaf()) {
+        if (dir_is_neg[node.getAxis()]) {
+          stack[stack_size++] = {current.index + 1, active};
+          current             = {node.offset, active};
+        } else {
+          stack[stack_size++] = {node.offset, active};
+          current             = {current.index + 1, active};
+        }
+        continue;
+      }
+
+      result |=
+          callback(rays, active, node.offset, node.offset + node.getCount());
+    }
+
+    if (stack_size == 0) break;
+    current = stack[--stack_size];
+  }
+
+  return result;
 }
 
 RDR_NAMESPACE_END
@@ -1,7 +1,9 @@
 #ifndef __FILM_H__
 #define __FILM_H__
 
+#include <condition_variable>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include "accel.h"
@@ -10,9 +12,52 @@
 
 RDR_NAMESPACE_BEGIN
 
+/// The progress of a progressive render, saved along with the film such that
+/// it can be resumed. The samplers are seeded by the pass index, so nothing
+/// else is needed to continue the sample sequence
+struct FilmCheckpoint {
+  int pass{0};     ///<! of the next pass to render
+  int samples{0};  ///<! per pixel accumulated so far
+};
+
+/**
+ * @brief The first two moments of the luminance of the samples falling inside
+ * a pixel, i.e. unfiltered, to estimate how far the pixel is from converged
+ * for adaptive sampling
+ */
+struct PixelMoments {
+  Double sum{0}, sum_squared{0};
+  Double count{0};
+
+  RDR_FORCEINLINE void add(Float value) {
+    sum         += value;
+    sum_squared += static_cast<Double>(value) * value;
+    count       += 1;
+  }
+
+  RDR_FORCEINLINE void merge(const PixelMoments &other) {
+    sum         += other.sum;
+    sum_squared += other.sum_squared;
+    count       += other.count;
+  }
+
+  /// Standard error of the mean over the mean, where means below min_mean
+  /// are clamped, such that black pixels do not blow the error up. Pixels of
+  /// less than two samples have an infinite error
+  Float getRelativeError(Float min_mean = 1e-3F) const {
+    if (count < 2) return std::numeric_limits<Float>::infinity();
+    const Double mean     = sum / count;
+    const Double variance = Max(0.0, (sum_squared - sum * mean) / (count - 1));
+    const Double clamped_mean = Max(mean, static_cast<Double>(min_mean));
+    return static_cast<Float>(std::sqrt(variance / count) / clamped_mean);
+  }
+};
+
 class Film : public ConfigurableObject {
 public:
   friend class FilmBlockView;
+  friend class FilmTile;
+  friend class FilmSnapshotWriter;
 
   // ++ Required by ConfigurableObject
   Film(const Properties &props);
@@ -25,6 +70,7 @@ public:
 
   Float getAspectRatio() const;
   Vec2i getResolution() const;
+  int getBlockSideLength() const { return block_side_length; }
 
   // ++ Required by Object
   std::string toString() const override {
@@ -46,22 +92,50 @@ public:
   void commitLightImageSplat(
       const Vec2f &sample_pos, const Vec3f &measurement);
 
+  /// Add the samples committed to the tile, @see FilmTile
+  void mergeTile(const FilmTile &tile);
+
+  /// Write the accumulation buffers and the progress to a checkpoint file,
+  /// return false if it cannot be written. The file is replaced atomically,
+  /// so the previous checkpoint survives a crash during the write
+  bool saveCheckpoint(
+      const fs::path &path, const FilmCheckpoint &checkpoint) const;
+
+  /// Restore the accumulation buffers from a checkpoint written by
+  /// saveCheckpoint(), throw if it is corrupted or of another resolution
+  FilmCheckpoint loadCheckpoint(const fs::path &path);
+
   Vec3f &getPixel(int x, int y);
   const Vec3f &getPixel(int x, int y) const;
   const vector<Vec3f> &getRawData() const { return data; }
+
+  /// @see PixelMoments
+  const PixelMoments &getMoments(int x, int y) const {
+    return moments[x + resolution.x * y];
+  }
+
   Vec3f& getLightPixel(int x, int y) { return light_data[x + resolution.x * y]; }
 
 private:
   ref<ReconstructionFilter> filter{nullptr};
+  FilterTable filter_table;  ///<! baked from filter at preprocess
   Vec2i resolution;
   vector<Vec3f> data, light_data;
   vector<Double> weight;
+  vector<PixelMoments> moments;
 
   // blockview-related
   uint32_t block_side_length;
   Vec2i block_resolution;
   vector<FilmBlockView> block_views;
 
+  // Serializes mergeTile() and the resolves of FilmSnapshotWriter
+  ref<std::mutex> merge_lock{make_ref<std::mutex>()};
+
+  /// Normalize the film into vertically flipped RGB triples as stored in EXR,
+  /// pixels without any weight only keep the light image
+  void resolveToRGB(vector<float> &rgb_data) const;
+
   template <typename T>
   RDR_FORCEINLINE bool isInside(const Vec<T, 2> &pos) const {
     return pos.x >= 0 && pos.x < resolution.x && pos.y >= 0 &&
@@ -145,6 +219,91 @@ protected:
   }
 };
 
+/// The order of scheduling the tiles of a film. Along space-filling curves,
+/// the tiles rendered close in time are close on the image, and so are the
+/// parts of the scene their rays visit
+enum class ETileOrder {
+  EScanline = 0,
+  EMorton   = 1,
+  EHilbert  = 2,
+};
+
+/// The name of the order in the "tile_order" property
+inline const char *GetTileOrderName(ETileOrder order) {
+  switch (order) {
+    case ETileOrder::EScanline:
+      return "scanline";
+    case ETileOrder::EMorton:
+      return "morton";
+    default:
+      return "hilbert";
+  }
+}
+
+/// Indices x + y * n_tiles.x of all of the tiles, in the given order
+vector<int> GetTileOrder(const Vec2i &n_tiles, ETileOrder order);
+
+/**
+ * @brief A private accumulation buffer of a tile of the film, padded by the
+ * footprint of the filter. A worker commits the samples of its tile without
+ * any lock, and merges them into the film once by Film::mergeTile, so the
+ * film is only contended once per tile instead of once per sample.
+ */
+class FilmTile {
+public:
+  /// Samples committed to the tile must lie in the pixels
+  /// [offset, offset + size)
+  FilmTile(const Film &film, const Vec2i &offset, const Vec2i &size);
+
+  RDR_FORCEINLINE Vec2i getOffset() const { return offset; }
+  RDR_FORCEINLINE Vec2i getSize() const { return size; }
+
+  /// @see Film::commitSample
+  void commitSample(const Vec2f &sample_pos, const Vec3f &measurement);
+
+protected:
+  friend class Film;
+
+  const FilterTable *filter_table;
+  int discrete_radius;
+  Vec2i resolution;  ///<! of the film
+  Vec2i offset, size;
+  Vec2i padded_offset, padded_size;  ///<! clipped to the film
+
+  vector<Vec3f> data;
+  vector<Double> weight;
+  vector<PixelMoments> moments;  ///<! of [offset, offset + size) only
+};
+
+/**
+ * @brief Periodically write the film being rendered to an EXR file from a
+ * background thread, so that long progressive renders can be inspected. The
+ * thread resolves the film into its own buffer under the merge lock of the
+ * film, so mergeTile() waits for a copy at most and never for the disk.
+ */
+class FilmSnapshotWriter {
+public:
+  FilmSnapshotWriter(const Film &film, fs::path path, Float interval);
+  ~FilmSnapshotWriter();
+
+  FilmSnapshotWriter(const FilmSnapshotWriter &)            = delete;
+  FilmSnapshotWriter &operator=(const FilmSnapshotWriter &) = delete;
+
+protected:
+  const Film &film;
+  const fs::path path;
+  const Float interval;  ///<! in seconds
+
+  vector<float> rgb_data;  ///<! only touched by the writer thread
+  std::mutex stop_lock;
+  std::condition_variable stop_requested;
+  bool stopped{false};
+
+  std::thread writer;  ///<! declared last, as it starts in the constructor
+
+  void run();
+};
+
 template <typename T>
 void Film::blockVisitor(const Vec2f &sample_pos, T visitor) {
   if (!isInside(sample_pos)) return;
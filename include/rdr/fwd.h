@@ -29,6 +29,7 @@ class Camera;
 class ReconstructionFilter;
 class Film;  // for saving
 class FilmBlockView;
+class FilmTile;
 struct Ray;
 struct DifferentialRay;
 struct SurfaceInteraction;
@@ -43,8 +44,10 @@ class TriangleMesh;
 
 /// Scene Objects
 class Accel;
+class BVHAccel;
 class Primitive;
 struct TriangleMeshResource;
+struct HitRecord;
 #ifdef USE_EMBREE
 class ExternalBvhAccel;
 #endif
@@ -1,15 +1,172 @@
 /**
- * A patch for efficient sampling. Just use it without understanding it.
- * RDR171 by zikexu: copied from a old implementation of myself,
- * which is not well-documented and I'm not sure if it's correct. But it seems
- * to work.
+ * @file halton.h
+ * @brief Low-discrepancy sequences for Sampler, i.e. Halton with random digit
+ * permutations and (0, 2)-Sobol with XOR or Owen scrambling, and the hashing
+ * they are randomized by. Every function here is stateless, so a sample is a
+ * function of its index, its dimension and a seed only.
+ *
+ * @see pbrt-v4, Chapter 8 (Sampling and Reconstruction)
  */
 #ifndef __HALTON_H__
 #define __HALTON_H__
 
-#include "rdr/math_utils.h"
+#include <algorithm>
+#include <array>
+#include <cstdint>
+
+#include "rdr/math_aliases.h"
+#include "rdr/platform.h"
 
 RDR_NAMESPACE_BEGIN
+
+/// The finalizer of MurmurHash3, which scrambles all of the bits of a key
+RDR_FORCEINLINE uint64_t MixBits(uint64_t hash) {
+  hash ^= hash >> 33;
+  hash *= 0xff51afd7ed558ccdULL;
+  hash ^= hash >> 33;
+  hash *= 0xc4ceb9fe1a85ec53ULL;
+  hash ^= hash >> 33;
+  return hash;
+}
+
+RDR_FORCEINLINE uint32_t ReverseBits32(uint32_t v) {
+  v = (v << 16U) | (v >> 16U);
+  v = ((v & 0x00ff00ffU) << 8U) | ((v & 0xff00ff00U) >> 8U);
+  v = ((v & 0x0f0f0f0fU) << 4U) | ((v & 0xf0f0f0f0U) >> 4U);
+  v = ((v & 0x33333333U) << 2U) | ((v & 0xccccccccU) >> 2U);
+  v = ((v & 0x55555555U) << 1U) | ((v & 0xaaaaaaaaU) >> 1U);
+  return v;
+}
+
+/// Element i of a random permutation of [0, n) chosen by the seed, without
+/// storing the permutation. See Kensler, Correlated Multi-Jittered Sampling
+RDR_FORCEINLINE uint32_t PermutationElement(
+    uint32_t i, uint32_t n, uint32_t seed) {
+  uint32_t w = n - 1;
+  w |= w >> 1U;
+  w |= w >> 2U;
+  w |= w >> 4U;
+  w |= w >> 8U;
+  w |= w >> 16U;
+  do {
+    i ^= seed;
+    i *= 0xe170893dU;
+    i ^= seed >> 16U;
+    i ^= (i & w) >> 4U;
+    i ^= seed >> 8U;
+    i *= 0x0929eb3fU;
+    i ^= seed >> 23U;
+    i ^= (i & w) >> 1U;
+    i *= 1U | seed >> 27U;
+    i *= 0x6935fa69U;
+    i ^= (i & w) >> 11U;
+    i *= 0x74dcb303U;
+    i ^= (i & w) >> 2U;
+    i *= 0x9e501cc3U;
+    i ^= (i & w) >> 2U;
+    i *= 0xc860a3dfU;
+    i &= w;
+    i ^= i >> 5U;
+  } while (i >= n);
+  return (i + seed) % n;
+}
+
+/// Map the bits of a fixed-point number in [0, 1) to a Float
+RDR_FORCEINLINE Float FixedPointToFloat(uint32_t v) {
+  return std::min<Float>(v * 0x1p-32F, 1 - Float_EPSILON);
+}
+
+/* ===================================================================== *
+ *
+ * Halton
+ *
+ * ===================================================================== */
+
+/// Dimensions of the Halton sequence, i.e. the number of its prime bases
+constexpr int HALTON_MAX_DIMENSIONS = 128;
+
+namespace detail_ {
+constexpr std::array<uint32_t, HALTON_MAX_DIMENSIONS> ComputeHaltonPrimes() {
+  std::array<uint32_t, HALTON_MAX_DIMENSIONS> primes{};
+  int n_primes = 0;
+  for (uint32_t candidate = 2; n_primes < HALTON_MAX_DIMENSIONS; ++candidate) {
+    bool is_prime = true;
+    for (int i = 0; i < n_primes && primes[i] * primes[i] <= candidate; ++i)
+      if (candidate % primes[i] == 0) is_prime = false;
+    if (is_prime) primes[n_primes++] = candidate;
+  }
+  return primes;
+}
+}  // namespace detail_
+
+/// The base of every dimension of the Halton sequence
+inline constexpr std::array<uint32_t, HALTON_MAX_DIMENSIONS> HALTON_PRIMES =
+    detail_::ComputeHaltonPrimes();
+
+/**
+ * @brief The radical inverse of index in the base, where the k-th digit is
+ * permuted by a random permutation chosen by hashing (seed, k). Digits are
+ * produced until the result is exact in Float, since the permutation maps
+ * the trailing zeros to non-zero digits too.
+ */
+RDR_FORCEINLINE Float ScrambledRadicalInverse(
+    uint32_t base, uint64_t index, uint64_t seed) {
+  const Float inv_base = Float(1) / base;
+  Float inv_base_m     = 1;
+  uint64_t reversed    = 0;
+  for (uint64_t digit_index = 0; 1 - (base - 1) * inv_base_m < 1;
+      ++digit_index) {
+    const uint64_t next  = index / base;
+    const auto digit     = static_cast<uint32_t>(index - next * base);
+    const auto digit_seed = static_cast<uint32_t>(MixBits(seed ^ digit_index));
+    reversed    = reversed * base + PermutationElement(digit, base, digit_seed);
+    inv_base_m *= inv_base;
+    index       = next;
+  }
+  return std::min<Float>(inv_base_m * reversed, 1 - Float_EPSILON);
+}
+
+/// Dimension of point index of the Halton sequence, randomized by the seed
+RDR_FORCEINLINE Float HaltonSample(
+    int dimension, uint64_t index, uint64_t seed) {
+  return ScrambledRadicalInverse(HALTON_PRIMES[dimension], index, seed);
+}
+
+/* ===================================================================== *
+ *
+ * Sobol
+ *
+ * ===================================================================== */
+
+/// The first two dimensions of the Sobol sequence, which form a (0, 2)-
+/// sequence in base 2, as 32-bit fixed-point numbers
+RDR_FORCEINLINE uint32_t SobolSampleBits(uint32_t index, int dimension) {
+  if (dimension == 0) return ReverseBits32(index);
+
+  // Generator of the polynomial x + 1, i.e. v_i = v_{i-1} ^ (v_{i-1} >> 1)
+  uint32_t bits = 0;
+  for (uint32_t v = 1U << 31U; index != 0; index >>= 1U, v ^= v >> 1U)
+    if ((index & 1U) != 0) bits ^= v;
+  return bits;
+}
+
+/// A random digital shift, which keeps the stratification of the sequence
+RDR_FORCEINLINE uint32_t XORScramble(uint32_t bits, uint32_t seed) {
+  return bits ^ seed;
+}
+
+/// Owen scrambling, i.e. every bit is flipped by a hash of the bits above
+/// it. See Laine and Karras, Stratified Sampling for Stochastic Transparency
+RDR_FORCEINLINE uint32_t OwenScramble(uint32_t bits, uint32_t seed) {
+  bits  = ReverseBits32(bits);
+  bits ^= bits * 0x3d20adeaU;
+  bits += seed;
+  bits *= (seed >> 16U) | 1U;
+  bits ^= bits * 0x05526c56U;
+  bits ^= bits * 0x53a22864U;
+  return ReverseBits32(bits);
+}
+
 RDR_NAMESPACE_END
 
 #endif
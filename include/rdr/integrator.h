@@ -12,18 +12,43 @@
 #ifndef __INTEGRATOR_H__
 #define __INTEGRATOR_H__
 
+#include "rdr/film.h"
 #include "rdr/interaction.h"
 #include "rdr/math_utils.h"
+#include "rdr/parallel_utils.h"
 #include "rdr/path.h"
 
 RDR_NAMESPACE_BEGIN
 
 class Integrator : public ConfigurableObject {
 public:
-  Integrator(const Properties &props) : ConfigurableObject(props) {}
+  Integrator(const Properties &props)
+      : ConfigurableObject(props), executor(props) {
+    auto sampler_name =
+        props.getProperty<std::string>("sampler", "independent");
+    if (sampler_name == "independent") {
+      sampler_type = ESamplerType::EIndependent;
+    } else if (sampler_name == "halton") {
+      sampler_type = ESamplerType::EHalton;
+    } else if (sampler_name == "sobol") {
+      sampler_type = ESamplerType::ESobol;
+    } else if (sampler_name == "owen_sobol") {
+      sampler_type = ESamplerType::EOwenSobol;
+    } else {
+      Exception_("Sampler [ {} ] is not supported", sampler_name);
+    }
+  }
 
   virtual void render(ref<Camera> camera, ref<Scene> scene) = 0;
   std::string toString() const override                     = 0;
+
+protected:
+  /// Where the tasks of render() are dispatched, @see ParallelExecute
+  ExecutorSettings executor;
+
+  /// The sequence the Samplers of render() draw from, configured by the
+  /// "sampler" property, @see Sampler::setType
+  ESamplerType sampler_type{ESamplerType::EIndependent};
 };
 
 /// @brief A simple & dirty integrator that only performs direct illumination
@@ -40,6 +65,36 @@ public:
 
     max_depth = props.getProperty<int>("max_depth", 16);
     spp       = props.getProperty<int>("spp", 8);
+    tiled     = props.getProperty<bool>("tiled", true);
+    tile_size = props.getProperty<int>("tile_size", 0);
+    if (tile_size < 0) Exception_("tile_size should be non-negative");
+
+    auto order_name = props.getProperty<std::string>("tile_order", "hilbert");
+    if (order_name == "scanline") {
+      tile_order = ETileOrder::EScanline;
+    } else if (order_name == "morton") {
+      tile_order = ETileOrder::EMorton;
+    } else if (order_name == "hilbert") {
+      tile_order = ETileOrder::EHilbert;
+    } else {
+      Exception_("Tile order [ {} ] is not supported", order_name);
+    }
+
+    snapshot_interval = props.getProperty<Float>("snapshot_interval", 60.0F);
+    snapshot_path =
+        props.getProperty<std::string>("snapshot_path", "snapshot.exr");
+    checkpoint_path = props.getProperty<std::string>("checkpoint_path", "");
+    resume          = props.getProperty<bool>("resume", false);
+    time_limit      = props.getProperty<Float>("time_limit", 0.0F);
+    progressive     = props.getProperty<bool>("progressive", false) ||
+                      !checkpoint_path.empty() || time_limit > 0;
+
+    adaptive_threshold = props.getProperty<Float>("adaptive_threshold", 0.0F);
+    adaptive_min_spp   = props.getProperty<int>("adaptive_min_spp", 16);
+    if (adaptive_min_spp < 2) Exception_("adaptive_min_spp should be >= 2");
+    if (adaptive_threshold > 0 && progressive)
+      Exception_("Adaptive sampling cannot be combined with progressive "
+                 "rendering, checkpoints or time limits");
   }
 
   void render(ref<Camera> camera, ref<Scene> scene) override;
@@ -48,13 +103,31 @@ public:
   Vec3f Li(  // NOLINT
       ref<Scene> scene, DifferentialRay &ray, Sampler &sampler) const;
 
+  /// Same as Li(), but the first intersection of the ray is already known,
+  /// e.g. from Scene::intersectPacket
+  Vec3f Li(ref<Scene> scene, DifferentialRay &ray, Sampler &sampler,  // NOLINT
+      bool intersected, SurfaceInteraction interaction) const;
+
   std::string toString() const override {
     std::ostringstream ss;
     ss << "IntersectionTestIntegrator[\n"
        << format("  point_light_position = {}\n", point_light_position)
        << format("  point_light_flux     = {}\n", point_light_flux)
        << format("  max_depth           = {}\n", max_depth)
-       << format("  spp                 = {}\n", spp) << "]";
+       << format("  spp                 = {}\n", spp)
+       << format("  tiled               = {}\n", tiled)
+       << format("  tile_size           = {}\n", tile_size)
+       << format("  tile_order          = {}\n", GetTileOrderName(tile_order))
+       << format("  sampler             = {}\n", GetSamplerName(sampler_type))
+       << format("  progressive         = {}\n", progressive)
+       << format("  snapshot_interval   = {}\n", snapshot_interval)
+       << format("  snapshot_path       = {}\n", snapshot_path)
+       << format("  checkpoint_path     = {}\n", checkpoint_path)
+       << format("  resume              = {}\n", resume)
+       << format("  time_limit          = {}\n", time_limit)
+       << format("  adaptive_threshold  = {}\n", adaptive_threshold)
+       << format("  adaptive_min_spp    = {}\n", adaptive_min_spp)
+       << format("  executor            = {}\n", executor.toString()) << "]";
     return ss.str();
   }
 
@@ -69,6 +142,78 @@ protected:
   Vec3f point_light_flux;
 
   int max_depth, spp;
+
+  /// Render tile_size x tile_size tiles into private FilmTiles, instead of
+  /// committing every sample to the shared film. A zero tile_size uses the
+  /// block side length of the film, such that tiles align with its blocks
+  bool tiled;
+  int tile_size;
+  ETileOrder tile_order{ETileOrder::EHilbert};
+
+  /// Render in tiled passes of increasing spp, i.e. 1, 1, 2, 4, ..., and
+  /// write the film to snapshot_path every snapshot_interval seconds in the
+  /// meantime. Non-positive intervals disable the snapshots
+  bool progressive;
+  Float snapshot_interval;
+  std::string snapshot_path;
+
+  /// Save a FilmCheckpoint to checkpoint_path after every progressive pass,
+  /// and continue from it if resume is set. Implies progressive
+  std::string checkpoint_path;
+  bool resume;
+
+  /// Keep rendering progressive passes until time_limit seconds elapse,
+  /// instead of until spp is reached. Non-positive limits disable it.
+  /// Implies progressive
+  Float time_limit;
+
+  /// Spend the budget of spp samples per pixel adaptively: after
+  /// adaptive_min_spp samples everywhere, only the pixels whose relative
+  /// error, @see PixelMoments, is above adaptive_threshold keep being
+  /// sampled. Non-positive thresholds disable it
+  Float adaptive_threshold;
+  int adaptive_min_spp;
+
+  /// Render the passes of the progressive mode
+  void renderProgressive(ref<Camera> camera, ref<Scene> scene);
+
+  /// Render the passes of the adaptive mode
+  void renderAdaptive(ref<Camera> camera, ref<Scene> scene);
+
+  /// Render n_samples samples per pixel to all of the tiles of the film, or
+  /// only to the pixels x + y * resolution.x set in active if given
+  void renderTiles(ref<Camera> camera, ref<Scene> scene, int pass,
+      int n_samples, const vector<bool> *active = nullptr) const;
+
+  /// Trace n_samples camera rays of the pixel and commit the radiance to the
+  /// target, i.e. the Film or a FilmTile
+  template <typename Target>
+  void renderPixel(ref<Camera> camera, ref<Scene> scene, Sampler &sampler,
+      const Vec2i &pixel, int n_samples, Target &target) const;
+};
+
+/// @brief Visualize the cost of finding the first hit of the camera rays. The
+/// red channel of the film is the number of BVH nodes visited per ray, and
+/// the green one the number of primitives tested, i.e. triangles and shapes.
+/// Write the film to an EXR to keep the raw counts.
+class TraversalHeatmapIntegrator : public Integrator {
+public:
+  TraversalHeatmapIntegrator(const Properties &props) : Integrator(props) {
+    spp = props.getProperty<int>("spp", 4);
+  }
+
+  void render(ref<Camera> camera, ref<Scene> scene) override;
+
+  std::string toString() const override {
+    std::ostringstream ss;
+    ss << "TraversalHeatmapIntegrator[\n"
+       << format("  spp      = {}\n", spp)
+       << format("  executor = {}\n", executor.toString()) << "]";
+    return ss.str();
+  }
+
+protected:
+  int spp;
 };
 
 /// Retained for debugging
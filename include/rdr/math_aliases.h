@@ -188,6 +188,11 @@ RDR_FORCEINLINE decltype(auto) Pow(const T &x, Float y) {
   return linalg::pow(x, y);
 }
 
+template <typename T>
+RDR_FORCEINLINE decltype(auto) Abs(const T &x) {
+  return linalg::abs(x);
+}
+
 template <typename T, typename... Args>
 RDR_FORCEINLINE decltype(auto) Min(const T &x, const Args &...args) {
   return Min(x, Min(args...));
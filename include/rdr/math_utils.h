@@ -15,9 +15,11 @@
 #include <algorithm>
 #include <array>
 #include <cmath>
+#include <cstdint>
 #include <random>
 
 #include "rdr/canary.h"
+#include "rdr/halton.h"
 #include "rdr/math_aliases.h"
 #include "rdr/platform.h"
 
@@ -247,6 +249,11 @@ RDR_FORCEINLINE T Mod(T a, T b) {
   }
 }
 
+/// The Y of CIE XYZ of linear sRGB
+RDR_FORCEINLINE Float Luminance(const Vec3f &rgb) {
+  return Dot(rgb, Vec3f(0.2126F, 0.7152F, 0.0722F));
+}
+
 RDR_FORCEINLINE uint8_t GammaCorrection(float radiance) {
   /// This with result in different result from mitsuba 0.6, whose tone mapper
   /// is really complex. So if you want to precisely debug the renderer, use
@@ -272,36 +279,237 @@ RDR_FORCEINLINE Vec3f DeNan(const Vec3f &vec, float val) {
  *
  * ===================================================================== */
 
+/**
+ * @brief The PCG32 generator, see https://www.pcg-random.org. It has 16 bytes
+ * of state and jumps ahead in O(log n), so a stream is addressed by its
+ * sequence and an offset instead of being consumed in order.
+ */
+class PCG32 {
+public:
+  using result_type = uint32_t;
+
+  PCG32() { setSequence(0); }
+  explicit PCG32(uint64_t sequence, uint64_t seed) {
+    setSequence(sequence, seed);
+  }
+
+  /// Restart at the beginning of the sequence
+  void setSequence(uint64_t sequence, uint64_t seed) {
+    state = 0;
+    inc   = (sequence << 1U) | 1U;
+    (*this)();
+    state += seed;
+    (*this)();
+  }
+
+  void setSequence(uint64_t sequence) {
+    setSequence(sequence, MixBits(sequence));
+  }
+
+  RDR_FORCEINLINE uint32_t operator()() {
+    const uint64_t old_state = state;
+    state                    = old_state * MULTIPLIER + inc;
+    const auto xorshifted =
+        static_cast<uint32_t>(((old_state >> 18U) ^ old_state) >> 27U);
+    const auto rot = static_cast<uint32_t>(old_state >> 59U);
+    return (xorshifted >> rot) | (xorshifted << ((~rot + 1U) & 31U));
+  }
+
+  /// Uniform in [0, 1)
+  RDR_FORCEINLINE Float uniform() {
+    return std::min<Float>((*this)() * 0x1p-32F, 1 - Float_EPSILON);
+  }
+
+  /// Skip the next delta numbers
+  void advance(uint64_t delta) {
+    uint64_t cur_mult = MULTIPLIER, cur_plus = inc;
+    uint64_t acc_mult = 1, acc_plus = 0;
+    while (delta > 0) {
+      if (delta & 1U) {
+        acc_mult *= cur_mult;
+        acc_plus  = acc_plus * cur_mult + cur_plus;
+      }
+      cur_plus  = (cur_mult + 1) * cur_plus;
+      cur_mult *= cur_mult;
+      delta    /= 2;
+    }
+    state = acc_mult * state + acc_plus;
+  }
+
+  static constexpr result_type min() { return 0; }
+  static constexpr result_type max() { return UINT32_MAX; }
+
+private:
+  static constexpr uint64_t MULTIPLIER = 0x5851f42d4c957f2dULL;
+
+  uint64_t state, inc;
+};
+
+/// The sequences Sampler draws its numbers from
+enum class ESamplerType {
+  EIndependent = 0,  ///<! uniform random numbers of PCG32
+  EHalton      = 1,  ///<! Halton with random digit permutations
+  ESobol       = 2,  ///<! padded (0, 2)-Sobol with XOR scrambling
+  EOwenSobol   = 3,  ///<! padded (0, 2)-Sobol with Owen scrambling
+};
+
+/// The name of the type in the "sampler" property of the integrators
+inline const char *GetSamplerName(ESamplerType type) {
+  switch (type) {
+    case ESamplerType::EHalton:
+      return "halton";
+    case ESamplerType::ESobol:
+      return "sobol";
+    case ESamplerType::EOwenSobol:
+      return "owen_sobol";
+    default:
+      return "independent";
+  }
+}
+
+/**
+ * @brief The samples of the integrators. Every number drawn for a pixel is a
+ * function of (seed, pixel, sample index, dimension) only, so the image does
+ * not depend on the threads or the order of the pixels. Call setPixelIndex2D
+ * and startPixelSample before drawing the numbers of a camera sample.
+ *
+ * The low-discrepancy types are dispatched by a branch instead of virtual
+ * calls. Sobol is padded, i.e. every dimension (pair) shuffles the samples of
+ * the pixel independently, so it has no dimension limit; Halton falls back to
+ * uniform random numbers beyond HALTON_MAX_DIMENSIONS.
+ */
 class Sampler {
 public:
-  virtual ~Sampler() = default;
+  /// Dimensions reserved for every sample, i.e. the stride of the stream
+  static constexpr uint64_t MAX_DIMENSIONS = 65536;
+
+  Sampler() { startPixelSample(0); }
+
+  /// Sobol shuffles the first samples_per_pixel samples of every pixel, so
+  /// it should be the number of samples rendered with the seed
+  void setType(ESamplerType sampler_type, int samples_per_pixel = 1) {
+    type = sampler_type;
+    spp  = static_cast<uint32_t>(Max(samples_per_pixel, 1));
+  }
 
-  RDR_FORCEINLINE virtual bool resetAfterIteration() { return true; }
-  RDR_FORCEINLINE virtual Float get1D() { return Clamp01(dis(engine)); }
-  RDR_FORCEINLINE virtual Vec2f get2D() { return {get1D(), get1D()}; }
-  RDR_FORCEINLINE virtual void setSeed(int i) { engine.seed(i); }
-  RDR_FORCEINLINE virtual void setPixelIndex2D(const Vec2i &index) {
+  RDR_FORCEINLINE ESamplerType getType() const { return type; }
+
+  RDR_FORCEINLINE bool resetAfterIteration() { return true; }
+  RDR_FORCEINLINE Float get1D() {
+    if (type == ESamplerType::EIndependent) {
+      ++dimension;
+      return rng.uniform();
+    }
+    return getLowDiscrepancy1D();
+  }
+
+  RDR_FORCEINLINE Vec2f get2D() {
+    if (type == ESamplerType::ESobol || type == ESamplerType::EOwenSobol)
+      return getSobol2D();
+    return {get1D(), get1D()};
+  }
+
+  /// Change the seed, e.g. to render another pass with new samples
+  void setSeed(int i) {
+    seed = MixBits(static_cast<uint64_t>(i));
+    startPixelSample(0);
+  }
+
+  RDR_FORCEINLINE void setPixelIndex2D(const Vec2i &index) {
     pixel_index = index;
+    startPixelSample(0);
   }
 
-  RDR_FORCEINLINE virtual const Vec2i &getPixelIndex2D() const {
-    return pixel_index;
+  RDR_FORCEINLINE const Vec2i &getPixelIndex2D() const { return pixel_index; }
+
+  /// Continue at the dimension of the sample of the current pixel
+  void startPixelSample(int index, int start_dimension = 0) {
+    const uint64_t pixel =
+        (static_cast<uint64_t>(static_cast<uint32_t>(pixel_index.x)) << 32U) |
+        static_cast<uint32_t>(pixel_index.y);
+    pixel_seed   = MixBits(pixel ^ seed);
+    sample_index = static_cast<uint32_t>(index);
+    dimension    = start_dimension;
+    rng.setSequence(pixel_seed);
+    rng.advance(static_cast<uint64_t>(index) * MAX_DIMENSIONS +
+                start_dimension);
   }
 
-  RDR_FORCEINLINE virtual Vec2f getPixelSample() {
+  /// The dimension of the next number of the current sample
+  RDR_FORCEINLINE int getDimension() const { return dimension; }
+
+  RDR_FORCEINLINE Vec2f getPixelSample() {
     return Cast<Float>(pixel_index) + get2D();
   }
 
   /** Shuffle a given array using the engine */
   template <typename InIterator>
   void shuffle(InIterator begin, InIterator end) {
-    std::shuffle(begin, end, engine);
+    std::shuffle(begin, end, rng);
   }
 
 protected:
-  Vec2i pixel_index;
-  std::mt19937 engine;
-  std::uniform_real_distribution<Float> dis{0, 1 - Float_EPSILON};
+  Vec2i pixel_index{0, 0};
+  uint64_t seed{0};
+  int dimension{0};
+  PCG32 rng;
+
+  ESamplerType type{ESamplerType::EIndependent};
+  uint32_t spp{1};
+  uint64_t pixel_seed{0};
+  uint32_t sample_index{0};
+
+  /// The seed of the current dimension of the pixel
+  RDR_FORCEINLINE uint64_t getDimensionSeed() const {
+    return MixBits(pixel_seed ^ static_cast<uint64_t>(dimension));
+  }
+
+  /// The sample of the pixel that the current dimension (pair) of Sobol uses
+  RDR_FORCEINLINE uint32_t getSobolIndex(uint64_t dimension_seed) const {
+    // Samples beyond spp are not shuffled, as they are rendered with another
+    // seed by the integrators anyway
+    if (sample_index >= spp) return sample_index;
+    return PermutationElement(
+        sample_index, spp, static_cast<uint32_t>(dimension_seed));
+  }
+
+  RDR_FORCEINLINE uint32_t scrambleSobol(
+      uint32_t bits, uint32_t scramble_seed) const {
+    return type == ESamplerType::EOwenSobol ? OwenScramble(bits, scramble_seed)
+                                            : XORScramble(bits, scramble_seed);
+  }
+
+  Float getLowDiscrepancy1D() {
+    const uint64_t dimension_seed = getDimensionSeed();
+    if (type == ESamplerType::EHalton) {
+      if (dimension >= HALTON_MAX_DIMENSIONS) {
+        // The stream is positioned at the dimension by startPixelSample
+        ++dimension;
+        return rng.uniform();
+      }
+      rng();
+      return HaltonSample(dimension++, sample_index, dimension_seed);
+    }
+
+    rng();
+    ++dimension;
+    const uint32_t index = getSobolIndex(dimension_seed);
+    return FixedPointToFloat(scrambleSobol(SobolSampleBits(index, 0),
+        static_cast<uint32_t>(dimension_seed >> 32U)));
+  }
+
+  Vec2f getSobol2D() {
+    const uint64_t dimension_seed = getDimensionSeed();
+    rng.advance(2);
+    dimension += 2;
+
+    const uint32_t index = getSobolIndex(dimension_seed);
+    const uint64_t scramble_seed = MixBits(dimension_seed);
+    return {FixedPointToFloat(scrambleSobol(SobolSampleBits(index, 0),
+                static_cast<uint32_t>(scramble_seed))),
+        FixedPointToFloat(scrambleSobol(SobolSampleBits(index, 1),
+            static_cast<uint32_t>(scramble_seed >> 32U)))};
+  }
 };
 
 /**
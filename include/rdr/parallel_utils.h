@@ -15,10 +15,69 @@
 
 #include <omp.h>
 
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include "rdr/properties.h"
 #include "rdr/rdr.h"
 
 RDR_NAMESPACE_BEGIN
 
+namespace detail_ {
+/**
+ * @brief Per-worker deques of task indices for work stealing. Every worker
+ * starts with a contiguous chunk of the tasks and pops its own deque from the
+ * front, i.e. in order. Once it runs dry, it steals from the back of the
+ * others, so neighbouring tasks tend to stay on the same worker.
+ */
+template <typename IndexType>
+class WorkStealingQueues {
+public:
+  WorkStealingQueues(IndexType begin, IndexType end, int n_queues)
+      : queues(Max(n_queues, 1)) {
+    const auto n_tasks = static_cast<int64_t>(end - begin);
+    const auto n       = static_cast<int64_t>(queues.size());
+    for (int64_t queue = 0; queue < n; ++queue) {
+      const auto first = static_cast<IndexType>(begin + n_tasks * queue / n);
+      const auto last =
+          static_cast<IndexType>(begin + n_tasks * (queue + 1) / n);
+      for (IndexType index = first; index < last; ++index)
+        queues[queue].tasks.push_back(index);
+    }
+  }
+
+  /// Take the next task of the worker, return false if all tasks are taken
+  bool pop(int worker, IndexType &index) {
+    const int n = static_cast<int>(queues.size());
+    for (int offset = 0; offset < n; ++offset) {
+      Queue &queue = queues[(worker + offset) % n];
+      std::scoped_lock<std::mutex> lock(queue.lock);
+      if (queue.tasks.empty()) continue;
+      if (offset == 0) {
+        index = queue.tasks.front();
+        queue.tasks.pop_front();
+      } else {
+        index = queue.tasks.back();
+        queue.tasks.pop_back();
+      }
+      return true;
+    }
+    return false;
+  }
+
+private:
+  struct Queue {
+    std::mutex lock;
+    std::deque<IndexType> tasks;
+  };
+
+  vector<Queue> queues;
+};
+}  // namespace detail_
+
 template <typename ExecutorType>
 class ExecutorInterface {
 public:
@@ -38,9 +97,7 @@ public:
   /**
    * @brief Block and wait for all the tasks to finish.
    */
-  void wait_for_all() {
-    static_cast<const ExecutorType &>(*this).wait_for_all();
-  }
+  void wait_for_all() { static_cast<ExecutorType &>(*this).wait_for_all(); }
 
 protected:
   ExecutorInterface()          = default;
@@ -48,19 +105,122 @@ protected:
 };
 
 // class TBBExecutor : public ExecutorInterface {};
+/// Run the tasks on the threads of an OpenMP parallel region. Every thread
+/// default-constructs one TLSType and schedules the tasks by work stealing
 class OMPExecutor : public ExecutorInterface<OMPExecutor> {
 public:
-  /// @see ExecutorInterface::execute
+  /// Non-positive num_threads uses omp_get_max_threads()
+  explicit OMPExecutor(int num_threads = 0)
+      : num_threads(num_threads > 0 ? num_threads : omp_get_max_threads()) {}
+
+  /// @see ExecutorInterface::execute, which returns after all of the tasks
+  /// are finished for OpenMP
   template <typename IndexType, typename TLSType,
       typename FuncType = std::function<void(IndexType &, TLSType &)>>
   void execute(IndexType begin, IndexType end, const FuncType &func) {
-    // TODO: is it too complex?
+    detail_::WorkStealingQueues<IndexType> queues(begin, end, num_threads);
+#pragma omp parallel num_threads(num_threads)
+    {
+      TLSType tls{};
+      IndexType index;
+      while (queues.pop(omp_get_thread_num(), index)) func(index, tls);
+    }
   }
 
   /// @see ExecutorInterface::wait_for_all
   void wait_for_all() {}
+
+private:
+  int num_threads;
+};
+
+/// Same as OMPExecutor, but on native threads that are launched by execute()
+/// and joined by wait_for_all(), e.g. for toolchains without OpenMP
+class ThreadExecutor : public ExecutorInterface<ThreadExecutor> {
+public:
+  /// Non-positive num_threads uses std::thread::hardware_concurrency()
+  explicit ThreadExecutor(int num_threads = 0)
+      : num_threads(num_threads > 0 ? num_threads : GetNumCores()) {}
+  ~ThreadExecutor() override { wait_for_all(); }
+
+  /// @see ExecutorInterface::execute
+  template <typename IndexType, typename TLSType,
+      typename FuncType = std::function<void(IndexType &, TLSType &)>>
+  void execute(IndexType begin, IndexType end, const FuncType &func) {
+    wait_for_all();
+    auto queues = std::make_shared<detail_::WorkStealingQueues<IndexType>>(
+        begin, end, num_threads);
+    for (int worker = 0; worker < num_threads; ++worker) {
+      workers.emplace_back([queues, func, worker]() {
+        TLSType tls{};
+        IndexType index;
+        while (queues->pop(worker, index)) func(index, tls);
+      });
+    }
+  }
+
+  /// @see ExecutorInterface::wait_for_all
+  void wait_for_all() {
+    for (auto &worker : workers) worker.join();
+    workers.clear();
+  }
+
+private:
+  int num_threads;
+  vector<std::thread> workers;
+
+  static int GetNumCores() {
+    return Max(static_cast<int>(std::thread::hardware_concurrency()), 1);
+  }
 };
 
+/// The executor integrators dispatch their tasks to, configured by the
+/// "executor" ("omp" or "thread") and "threads" properties
+struct ExecutorSettings {
+  enum class EBackend {
+    EOpenMP = 0,
+    EThread = 1,
+  };
+
+  EBackend backend{EBackend::EOpenMP};
+  int num_threads{0};  ///<! non-positive for all of the cores
+
+  ExecutorSettings() = default;
+  explicit ExecutorSettings(const Properties &props)
+      : num_threads(props.getProperty<int>("threads", 0)) {
+    const auto name = props.getProperty<std::string>("executor", "omp");
+    if (name == "omp" || name == "openmp") {
+      backend = EBackend::EOpenMP;
+    } else if (name == "thread") {
+      backend = EBackend::EThread;
+    } else {
+      Exception_("Executor {} not supported; use omp or thread", name);
+    }
+  }
+
+  std::string toString() const {
+    return format("{} with {} threads",
+        backend == EBackend::EThread ? "thread" : "omp", num_threads);
+  }
+};
+
+/// Run func(index, tls) for every index in [begin, end) on the executor of
+/// the settings, and wait for all of them. Every worker default-constructs
+/// its own TLSType once
+template <typename TLSType, typename IndexType, typename FuncType>
+void ParallelExecute(const ExecutorSettings &settings, IndexType begin,
+    IndexType end, const FuncType &func) {
+  if (settings.backend == ExecutorSettings::EBackend::EThread) {
+    ThreadExecutor executor(settings.num_threads);
+    executor.template execute<IndexType, TLSType>(begin, end, func);
+    executor.wait_for_all();
+  } else {
+    OMPExecutor executor(settings.num_threads);
+    executor.template execute<IndexType, TLSType>(begin, end, func);
+    executor.wait_for_all();
+  }
+}
+
 // We do not generalize this function for now because we don't want to increase
 // the complexity again.
 class ParallelHandler {
@@ -1,6 +1,7 @@
 #ifndef __PRIMITIVE_H__
 #define __PRIMITIVE_H__
 
+#include "rdr/ray.h"
 #include "rdr/rdr.h"
 
 RDR_NAMESPACE_BEGIN
@@ -35,6 +36,21 @@ public:
    */
   virtual bool intersect(Ray &ray, SurfaceInteraction &interaction) const;
 
+  /// The cheap part of intersect(), @see Shape::intersectHit
+  virtual bool intersectHit(Ray &ray, HitRecord &hit) const;
+
+  /// The deferred part of intersect(), which also fills the material, @see
+  /// Shape::computeSurfaceInteraction
+  virtual void computeSurfaceInteraction(const Ray &ray, const HitRecord &hit,
+      SurfaceInteraction &interaction) const;
+
+  /// Any-hit query of the underlying shape, @see Shape::occluded
+  virtual bool occluded(const Ray &ray) const;
+
+  /// Packet version of intersect(), @see Shape::intersectPacket
+  virtual RayMask intersectPacket(
+      Ray *rays, SurfaceInteraction *interactions, RayMask mask) const;
+
   /// Return the bounding box of the primitive
   virtual AABB getBound() const;
 
@@ -44,10 +60,16 @@ public:
   /// Return the area light of the primitive.
   virtual ref<AreaLight> getAreaLight() const noexcept { return area_light; }
 
+  /// Return the underlying shape
+  const ref<Shape> &getShape() const noexcept { return shape; }
+
   bool hasMaterial() const noexcept { return bsdf != nullptr; }
   bool hasAreaLight() const noexcept { return area_light != nullptr; }
 
 private:
+  /// Fill the material-related terms of a hit of the shape
+  void setInteraction(const Ray &ray, SurfaceInteraction &interaction) const;
+
   ref<Shape> shape{nullptr};
   ref<BSDF> bsdf{nullptr};
   ref<AreaLight> area_light{nullptr};
@@ -103,6 +103,18 @@ private:
   }
 };
 
+/// Rays traversed together are addressed by the bits of a RayMask, e.g. the
+/// rays of a packet still active below a BVH node
+using RayMask = uint32_t;
+
+/// The number of rays of a packet, @see BVHTree::intersectPacketLeaves
+constexpr int RAY_PACKET_SIZE = 16;
+static_assert(RAY_PACKET_SIZE <= 32, "RayMask should cover the packet");
+
+RDR_FORCEINLINE bool IsRayActive(RayMask mask, int i) {
+  return (mask >> i) & 1;
+}
+
 struct DifferentialRay final : public Ray {
   template <typename T>
   using WrapperType = std::add_lvalue_reference_t<T>;
@@ -11,6 +11,8 @@
 #ifndef __RFILTER_H__
 #define __RFILTER_H__
 
+#include <array>
+
 #include "rdr/factory.h"
 #include "rdr/object.h"
 
@@ -24,8 +26,13 @@ class ReconstructionFilter : public ConfigurableObject {
 public:
   virtual ~ReconstructionFilter() = default;
 
-  /// Evaluate the filter function
-  virtual Float evaluate(const Vec2f &relative_pos) const = 0;
+  /// Evaluate the filter function, which is separable for all of the filters
+  Float evaluate(const Vec2f &relative_pos) const {
+    return evaluate1D(relative_pos.x) * evaluate1D(relative_pos.y);
+  }
+
+  /// Evaluate the 1D factor of the filter function on [-radius, radius]
+  virtual Float evaluate1D(Float d) const = 0;
   RDR_FORCEINLINE Float getRadius() const { return radius; }
 
 protected:
@@ -36,14 +43,47 @@ protected:
         radius(props.getProperty<Float>("radius", 0.5)) {}
   // --
 
-  RDR_FORCEINLINE bool isInside(const Vec2f &relative_pos) const {
-    return (std::abs(relative_pos.x) <= radius) &&
-           (std::abs(relative_pos.y) <= radius);
-  }
+  RDR_FORCEINLINE bool isInside(Float d) const { return std::abs(d) <= radius; }
 
   Float radius;
 };
 
+/**
+ * @brief The 1D factor of a filter baked into a table over [0, radius]. Film
+ * bakes it once at preprocess, so weighting a sample needs neither a virtual
+ * call nor exp/polynomial evaluations.
+ */
+class FilterTable {
+public:
+  static constexpr int TABLE_SIZE = 256;
+
+  FilterTable() = default;
+  explicit FilterTable(const ReconstructionFilter &filter)
+      : radius(filter.getRadius()), inv_step(TABLE_SIZE / radius) {
+    // Each entry is the filter at the center of its interval
+    for (int i = 0; i < TABLE_SIZE; ++i)
+      table[i] = filter.evaluate1D((i + 0.5_F) / inv_step);
+  }
+
+  RDR_FORCEINLINE Float getRadius() const { return radius; }
+
+  /// @see ReconstructionFilter::evaluate1D
+  RDR_FORCEINLINE Float evaluate1D(Float d) const {
+    d = std::abs(d);
+    if (d > radius) return 0;
+    return table[Min(static_cast<int>(d * inv_step), TABLE_SIZE - 1)];
+  }
+
+  /// @see ReconstructionFilter::evaluate
+  RDR_FORCEINLINE Float evaluate(const Vec2f &relative_pos) const {
+    return evaluate1D(relative_pos.x) * evaluate1D(relative_pos.y);
+  }
+
+private:
+  Float radius{0}, inv_step{0};
+  std::array<Float, TABLE_SIZE> table{};
+};
+
 // =======================================================================
 // See
 // https://pbr-book.org/3ed-2018/Sampling_and_Reconstruction/Image_Reconstruction
@@ -55,9 +95,7 @@ public:
   BoxFilter(const Properties &props) : ReconstructionFilter(props) {}
   // --
 
-  Float evaluate(const Vec2f &relative_pos) const override {
-    return isInside(relative_pos) ? 1.0 : 0.0;
-  }
+  Float evaluate1D(Float d) const override { return isInside(d) ? 1.0 : 0.0; }
 };
 
 class GaussianFilter final : public ReconstructionFilter {
@@ -66,18 +104,15 @@ public:
   GaussianFilter(const Properties &props)
       : ReconstructionFilter(props),
         alpha(props.getProperty<Float>("alpha", 2.0)),
-        exp_x(std::exp(-alpha * radius * radius)),
-        exp_y(std::exp(-alpha * radius * radius)) {}
+        exp_d(std::exp(-alpha * radius * radius)) {}
   // --
 
-  Float evaluate(const Vec2f &relative_pos) const override {
-    return isInside(relative_pos)
-             ? gaussian(relative_pos.x, exp_x) * gaussian(relative_pos.y, exp_y)
-             : 0;
+  Float evaluate1D(Float d) const override {
+    return isInside(d) ? gaussian(d, exp_d) : 0;
   }
 
 private:
-  Float alpha, exp_x, exp_y;
+  Float alpha, exp_d;
   RDR_FORCEINLINE Float gaussian(Float d, Float expv) const {
     return Max(static_cast<Float>(0),
         static_cast<Float>(std::exp(-alpha * d * d) - expv));
@@ -93,10 +128,8 @@ public:
         C(props.getProperty<Float>("C", 1.0 / 3.0)) {}
   // --
 
-  Float evaluate(const Vec2f &relative_pos) const override {
-    return isInside(relative_pos) ? mitchell1D(relative_pos.x / radius) *
-                                        mitchell1D(relative_pos.y / radius)
-                                  : 0;
+  Float evaluate1D(Float d) const override {
+    return isInside(d) ? mitchell1D(d / radius) : 0;
   }
 
 private:
@@ -24,6 +24,18 @@ public:
 private:
   DataType data{nullptr};
 };
+
+/**
+ * @brief A data node of the scene-level BVH as seen by Scene's traversal loop.
+ * Triangle meshes over a BVHAccel expose their bottom-level tree, which the
+ * loop descends into without any virtual call. Any other primitive goes
+ * through Primitive::intersectHit and Primitive::occluded.
+ */
+struct SceneInstance {
+  const Primitive *primitive{nullptr};
+  const TriangleMesh *mesh{nullptr};  ///<! nullptr if not descended into
+  const BVHAccel *accel{nullptr};     ///<! the accel of mesh
+};
 }  // namespace detail_
 
 /**
@@ -70,6 +82,28 @@ public:
     return infinite_light;
   }
 
+  /// Any-hit query for shadow rays, @see Accel::occluded
+  bool occluded(const Ray &ray) const;
+
+  /**
+   * @brief Closest-hit query of the coherent rays selected by mask, e.g.
+   * camera rays of nearby pixels, which share every node fetched from both the
+   * scene-level BVH and the BVHs of the meshes. The interaction of each ray
+   * behaves as in intersect(). Return the mask of rays with a hit.
+   */
+  RayMask intersectPacket(const Ray *rays, SurfaceInteraction *interactions,
+      RayMask mask) const;
+
+  /**
+   * @brief Closest-hit query of any number of rays. Rays are grouped into
+   * packets by the octant of their directions, such that even an incoherent
+   * stream traverses packets whose rays share the near-far order.
+   *
+   * @param hits whether each ray has a hit, i.e. intersect()'s result
+   */
+  void intersectStream(const Ray *rays, SurfaceInteraction *interactions,
+      bool *hits, int n_rays) const;
+
   /// Temporary
   bool isBlocked(const Ray &shadow_ray) const;
   bool isBlocked(const Ray &shadow_ray, SurfaceInteraction &interaction) const;
@@ -119,6 +153,13 @@ private:
 
   /// Scene level accelerator
   BVHTree<detail_::BVHPrimitiveNode> primitive_tree;
+  vector<detail_::SceneInstance> instances;  ///<! aligned with its data nodes
+
+  /// The single traversal loop over both the scene-level BVH and the ones of
+  /// the meshes, shared by intersect() and occluded()
+  template <bool AnyHit>
+  bool traverse(
+      Ray &ray, HitRecord &hit, const Primitive **hit_primitive) const;
 };
 
 RDR_REGISTER_CLASS(Scene)
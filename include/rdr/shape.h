@@ -3,6 +3,7 @@
 
 #include <memory>
 
+#include "rdr/accel.h"
 #include "rdr/rdr.h"
 
 RDR_NAMESPACE_BEGIN
@@ -23,8 +24,28 @@ public:
   /// Intersect ray with shape. If hit is found, return true and fill
   /// the SurfaceInteraction. Else, **return false and do nothing**, i.e.
   /// Surface Interaction will not be modified. This specification is important
-  /// for correctness. Note that interaction.dist is taken into account.
-  virtual bool intersect(Ray &ray, SurfaceInteraction &interaction) const = 0;
+  /// for correctness. Note that interaction.dist is taken into account. The
+  /// default is intersectHit() followed by computeSurfaceInteraction().
+  virtual bool intersect(Ray &ray, SurfaceInteraction &interaction) const;
+
+  /// The cheap part of intersect(): on hit, shrink the time range of the ray
+  /// to the hit and record it, else **return false and do nothing**. Nothing
+  /// but what computeSurfaceInteraction() needs is computed.
+  virtual bool intersectHit(Ray &ray, HitRecord &hit) const = 0;
+
+  /// The deferred part of intersect(): fill the SurfaceInteraction of the hit
+  /// recorded by intersectHit(), where the time range of the ray ends
+  virtual void computeSurfaceInteraction(const Ray &ray, const HitRecord &hit,
+      SurfaceInteraction &interaction) const = 0;
+
+  /// Any-hit query for shadow rays: return whether there is any hit within
+  /// [ray.t_min, ray.t_max], without computing the SurfaceInteraction.
+  virtual bool occluded(const Ray &ray) const = 0;
+
+  /// Closest-hit query of a packet of rays, @see Accel::intersectPacket. The
+  /// default intersects the rays one after another.
+  virtual RayMask intersectPacket(
+      Ray *rays, SurfaceInteraction *interactions, RayMask mask) const;
 
   /// Calculate the surface area of the shape to calculate PDF.
   virtual Float area() const = 0;
@@ -48,8 +69,15 @@ public:
   Sphere(const Properties &props);
   // --
 
-  /// @see Shape::intersect
-  bool intersect(Ray &ray, SurfaceInteraction &interaction) const override;
+  /// @see Shape::intersectHit
+  bool intersectHit(Ray &ray, HitRecord &hit) const override;
+
+  /// @see Shape::computeSurfaceInteraction
+  void computeSurfaceInteraction(const Ray &ray, const HitRecord &hit,
+      SurfaceInteraction &interaction) const override;
+
+  /// @see Shape::occluded
+  bool occluded(const Ray &ray) const override;
 
   /// @see Shape::area
   Float area() const override;
@@ -66,6 +94,9 @@ public:
 private:
   Vec3f center;
   Float radius;
+
+  /// Solve for the nearest hit distance within the time range of the ray
+  bool intersectDistance(const Ray &ray, Double *t) const;
 };
 
 /**
@@ -94,6 +125,12 @@ struct TriangleMeshResource {
  * implementation. For example, we can readily implement Struct of Array
  * triangles on this structure without extra definitions. We can also wrap other
  * acceleration structures like Embree.
+ * With "instanced": true, the mesh data and its accel (the bottom level of the
+ * scene BVH) stay in object space and are shared by every instanced
+ * TriangleMesh of the scene loading the same file with the same "accel" block.
+ * Each instance only owns its affine transform and the areas used for
+ * sampling. By default, the transform is baked into a private copy instead,
+ * which is also the fallback for projective transforms.
  */
 class TriangleMesh final : public Shape {
 public:
@@ -103,8 +140,19 @@ public:
   TriangleMesh(const Properties &props);
   // --
 
-  /// @see Shape::intersect
-  bool intersect(Ray &ray, SurfaceInteraction &interaction) const override;
+  /// @see Shape::intersectHit
+  bool intersectHit(Ray &ray, HitRecord &hit) const override;
+
+  /// @see Shape::computeSurfaceInteraction
+  void computeSurfaceInteraction(const Ray &ray, const HitRecord &hit,
+      SurfaceInteraction &interaction) const override;
+
+  /// @see Shape::occluded
+  bool occluded(const Ray &ray) const override;
+
+  /// @see Shape::intersectPacket
+  RayMask intersectPacket(Ray *rays, SurfaceInteraction *interactions,
+      RayMask mask) const override;
 
   /// @see Shape::area
   Float area() const override;
@@ -118,6 +166,21 @@ public:
   /// @see Shape::pdf
   Float pdf(const SurfaceInteraction &interaction) const override;
 
+  /// The mesh data, in object space if instanced
+  const ref<TriangleMeshResource> &getMeshResource() const { return mesh; }
+
+  /// The accel over the mesh data, in object space if instanced
+  const ref<Accel> &getAccel() const { return accel; }
+
+  /// Map the world-space ray into object space. The direction is
+  /// renormalized, so distances along the object-space ray are scaled by
+  /// *scale.
+  Ray rayToObject(const Ray &ray, Float *scale) const;
+
+  /// Forget the meshes shared by the instances created so far, such that the
+  /// next scene loads its own. Called by Scene once all of its shapes exist.
+  static void ClearSharedMeshes();
+
 protected:
   ref<Accel> accel;  //<! Any acceleration structure. Will not fully
                      // fill the interaction structure.
@@ -129,6 +192,30 @@ protected:
   vector<Float> areas;       //<! Area of each triangle. Will be
                              // calculated on construction.
   Float total_area{};        //<! Total area of the mesh.
+
+  /// instancing-related members.
+  bool has_transform{false};         //<! Object space is not world space
+  Mat4f to_world{IdentityMatrix4};   //<! Affine object-to-world transform
+  Mat4f to_object{IdentityMatrix4};  //<! Inverse of to_world
+  Mat3f normal_to_world{};           //<! Inverse transpose of to_world
+  AABB world_bound;                  //<! Bound of the instance in world space
+
+  /// Create the accel and fill both the mesh and the accel, either from the
+  /// BVHCache or by loading and building
+  void loadAccel(const std::string &path, const Mat4f &transform,
+      const Vec3f &translate, const Properties &accel_props,
+      bool has_accel_props);
+
+  /// Parse the OBJ file into mesh, transform it and fix the winding
+  void loadMesh(const std::string &path, const Mat4f &transform,
+      const Vec3f &translate);
+
+  Vec3f pointToWorld(const Vec3f &p) const {
+    return Mul(to_world, Vec4f(p, 1)).xyz();
+  }
+
+  /// Bring the differential geometry of an object-space hit to world space
+  void interactionToWorld(SurfaceInteraction &interaction) const;
 };
 
 RDR_REGISTER_CLASS(Sphere)
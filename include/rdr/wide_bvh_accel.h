@@ -0,0 +1,130 @@
+#ifndef __WIDE_BVH_ACCEL_H__
+#define __WIDE_BVH_ACCEL_H__
+
+#include "rdr/accel.h"
+#include "rdr/bvh_accel.h"
+#include "rdr/bvh_tree.h"
+#include "rdr/rdr.h"
+
+RDR_NAMESPACE_BEGIN
+
+namespace detail_ {
+/**
+ * @brief A node of the wide BVH. The bounds of all children are stored as
+ * Struct of Array, such that one SIMD slab test covers every child. Unused
+ * slots hold an empty (inverted) box and are never hit.
+ */
+template <int Width>
+struct alignas(32) WideBVHNode {
+  float low_bnd[3][Width];    ///<! low_bnd[axis][child]
+  float upper_bnd[3][Width];  ///<! upper_bnd[axis][child]
+  int32_t offset[Width];      ///<! interior: child node, leaf: first triangle
+  uint32_t count[Width];      ///<! number of triangles, 0 if interior
+
+  WideBVHNode();
+
+  void setBound(int slot, const Vec3f &low, const Vec3f &upper);
+};
+
+/**
+ * @brief A wide node whose child bounds are quantized to 8 bits in the local
+ * frame of the node (Ylitie et al. 2017), about half the size of WideBVHNode.
+ * A bound is decoded as origin + q * 2^exponent per axis. Since q * 2^exponent
+ * is exact, decoding is exact, and encoding rounds outwards, so a decoded box
+ * always encloses the original one.
+ */
+template <int Width>
+struct QuantizedWideBVHNode {
+  float origin[3];            ///<! lower corner of the frame
+  int8_t exponent[3];         ///<! the frame spans 255 * 2^exponent
+  uint8_t q_low[3][Width];    ///<! q_low[axis][child]
+  uint8_t q_upper[3][Width];  ///<! q_upper[axis][child]
+  int32_t offset[Width];      ///<! @see WideBVHNode
+  uint32_t count[Width];      ///<! @see WideBVHNode
+
+  QuantizedWideBVHNode() = default;
+  explicit QuantizedWideBVHNode(const WideBVHNode<Width> &node);
+
+  /// Decode the child bounds in the layout of WideBVHNode. Unused slots
+  /// decode to empty (inverted) boxes.
+  void decode(float low_bnd[3][Width], float upper_bnd[3][Width]) const;
+};
+}  // namespace detail_
+
+/**
+ * @brief A 4/8-ary BVH for triangle meshes. The binary tree built by BVHTree is
+ * collapsed into wide nodes, whose children are intersected all at once with
+ * SSE (Width = 4) or AVX (Width = 8) if available at compile time. With
+ * "quantized": true in the "accel" block, the nodes are stored as
+ * QuantizedWideBVHNode to trade some decoding for memory.
+ */
+template <int Width>
+class WideBVHAccel final : public Accel {
+public:
+  static_assert(Width == 4 || Width == 8, "Only BVH4 and BVH8 are supported");
+
+  /// @see BVHAccel::BVHAccel
+  WideBVHAccel();
+  explicit WideBVHAccel(const Properties &props);
+  ~WideBVHAccel() override = default;
+
+  /// @see Accel::setTriangleMesh
+  void setTriangleMesh(const ref<TriangleMeshResource> &mesh) override;
+
+  /// @see Accel::build
+  void build() override;
+
+  /// @see Accel::getBound
+  AABB getBound() const override;
+
+  /// @see Accel::intersectHit
+  bool intersectHit(Ray &ray, HitRecord &hit) const override;
+
+  /// @see Accel::occluded
+  bool occluded(const Ray &ray) const override;
+
+  /// @see Accel::update. The wide nodes cannot be refit in place, so they
+  /// are rebuilt with the same settings.
+  bool update() override;
+
+  /// @see Accel::getMemoryUsage
+  size_t getMemoryUsage() const override;
+
+  /// @see Accel::save
+  bool save(std::ostream &stream) const override;
+
+  /// @see Accel::load
+  bool load(
+      std::istream &stream, const ref<TriangleMeshResource> &mesh) override;
+
+private:
+  using NodeType          = detail_::WideBVHNode<Width>;
+  using QuantizedNodeType = detail_::QuantizedWideBVHNode<Width>;
+  using TreeType          = BVHTree<detail_::BVHTriangleNode>;
+
+  /// Every wide node visited pushes at most Width - 1 more entries than it
+  /// pops, hence the depth must stay within CUTOFF_DEPTH, checked by build()
+  constexpr static int STACK_SIZE = (Width - 1) * TreeType::CUTOFF_DEPTH + 1;
+
+  /// Only used during build(), released afterwards
+  TreeType binary_tree;
+
+  bool quantized{false};
+  vector<NodeType> wide_nodes;                ///<! root at 0, if !quantized
+  vector<QuantizedNodeType> quantized_nodes;  ///<! root at 0, if quantized
+  PackedTriangles triangles;                  ///<! in leaf order
+
+  /// Collapse the binary interior node into a wide node, return its index
+  int collapse(int binary_index);
+
+  /// The shared traversal loop of intersect() and occluded()
+  template <bool AnyHit, typename RayType, typename LeafCallback>
+  bool traverse(RayType &ray, LeafCallback callback) const;
+};
+
+using BVH4Accel = WideBVHAccel<4>;
+using BVH8Accel = WideBVHAccel<8>;
+
+RDR_NAMESPACE_END
+
+#endif
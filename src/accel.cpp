@@ -1,5 +1,6 @@
 #include "rdr/accel.h"
 
+#include "rdr/bvh_cache.h"
 #include "rdr/canary.h"
 #include "rdr/interaction.h"
 #include "rdr/math_aliases.h"
@@ -87,17 +88,27 @@ bool AABB::intersect(const Ray &ray, Float *t_in, Float *t_out) const {
 
 bool TriangleIntersect(Ray &ray, const uint32_t &triangle_index,
     const ref<TriangleMeshResource> &mesh, SurfaceInteraction &interaction) {
+  HitRecord hit;
+  if (!TriangleIntersectHit(ray, triangle_index, *mesh, hit)) return false;
+
+  CalculateTriangleDifferentials(interaction, hit.b, mesh, triangle_index);
+  AssertNear(interaction.p, ray(ray.t_max));
+  return true;
+}
+
+bool TriangleIntersectHit(Ray &ray, const uint32_t &triangle_index,
+    const TriangleMeshResource &mesh, HitRecord &hit) {
   using InternalScalarType = Double;
   using InternalVecType    = Vec<InternalScalarType, 3>;
 
   AssertAllValid(ray.direction, ray.origin);
   AssertAllNormalized(ray.direction);
 
-  const auto &vertices = mesh->vertices;
-  const Vec3u v_idx(&mesh->v_indices[3 * triangle_index]);
-  assert(v_idx.x < mesh->vertices.size());
-  assert(v_idx.y < mesh->vertices.size());
-  assert(v_idx.z < mesh->vertices.size());
+  const auto &vertices = mesh.vertices;
+  const Vec3u v_idx(&mesh.v_indices[3 * triangle_index]);
+  assert(v_idx.x < mesh.vertices.size());
+  assert(v_idx.y < mesh.vertices.size());
+  assert(v_idx.z < mesh.vertices.size());
 
   InternalVecType dir = Cast<InternalScalarType>(ray.direction);
   InternalVecType v0  = Cast<InternalScalarType>(vertices[v_idx[0]]);
@@ -155,17 +166,161 @@ bool TriangleIntersect(Ray &ray, const uint32_t &triangle_index,
   }
 
   // We will reach here if there is an intersection
-
-  CalculateTriangleDifferentials(interaction,
-      {static_cast<Float>(1 - u - v), static_cast<Float>(u),
-          static_cast<Float>(v)},
-      mesh, triangle_index);
-  AssertNear(interaction.p, ray(t));
+  hit.index = triangle_index;
+  hit.b     = Cast<Float>(InternalVecType(1 - u - v, u, v));
   assert(ray.withinTimeRange(t));
   ray.setTimeMax(t);
   return true;
 }
 
+bool WatertightTriangleIntersect(const Ray &ray, const Vec3f &p0,
+    const Vec3f &p1, const Vec3f &p2, Float *t_hit, Vec3f *b) {
+  // Translate the vertices into a coordinate system whose origin is the ray
+  // origin, and permute the axes so that the largest component of the
+  // direction becomes z
+  const int kz = ArgMax(Abs(ray.direction));
+  const int kx = (kz + 1) % 3;
+  const int ky = (kx + 1) % 3;
+
+  const auto permute = [&](const Vec3f &v) {
+    return Vec3f(v[kx], v[ky], v[kz]);
+  };
+
+  const Vec3f d = permute(ray.direction);
+  Vec3f p0t     = permute(p0 - ray.origin);
+  Vec3f p1t     = permute(p1 - ray.origin);
+  Vec3f p2t     = permute(p2 - ray.origin);
+
+  // Shear the direction onto +z, only x and y are needed for the edge tests
+  const Float sx = -d.x / d.z;
+  const Float sy = -d.y / d.z;
+  const Float sz = 1 / d.z;
+  p0t.x += sx * p0t.z;
+  p0t.y += sy * p0t.z;
+  p1t.x += sx * p1t.z;
+  p1t.y += sy * p1t.z;
+  p2t.x += sx * p2t.z;
+  p2t.y += sy * p2t.z;
+
+  Float e0 = p1t.x * p2t.y - p1t.y * p2t.x;
+  Float e1 = p2t.x * p0t.y - p2t.y * p0t.x;
+  Float e2 = p0t.x * p1t.y - p0t.y * p1t.x;
+
+  // Fall back to double precision on edges, where the sign matters most
+  if (e0 == 0 || e1 == 0 || e2 == 0) {
+    e0 = static_cast<Float>(static_cast<Double>(p1t.x) * p2t.y -
+                            static_cast<Double>(p1t.y) * p2t.x);
+    e1 = static_cast<Float>(static_cast<Double>(p2t.x) * p0t.y -
+                            static_cast<Double>(p2t.y) * p0t.x);
+    e2 = static_cast<Float>(static_cast<Double>(p0t.x) * p1t.y -
+                            static_cast<Double>(p0t.y) * p1t.x);
+  }
+
+  if ((e0 < 0 || e1 < 0 || e2 < 0) && (e0 > 0 || e1 > 0 || e2 > 0))
+    return false;
+  const Float det = e0 + e1 + e2;
+  if (det == 0) return false;
+
+  // Compare the scaled distance against the time range to delay the division
+  p0t.z *= sz;
+  p1t.z *= sz;
+  p2t.z *= sz;
+  const Float t_scaled = e0 * p0t.z + e1 * p1t.z + e2 * p2t.z;
+  if (det < 0 && (t_scaled > ray.t_min * det || t_scaled < ray.t_max * det))
+    return false;
+  if (det > 0 && (t_scaled < ray.t_min * det || t_scaled > ray.t_max * det))
+    return false;
+
+  const Float inv_det = 1 / det;
+  *t_hit              = t_scaled * inv_det;
+  *b                  = Vec3f(e0, e1, e2) * inv_det;
+  return ray.withinTimeRange(*t_hit);
+}
+
+void PackedTriangles::clear() {
+  v0.clear();
+  v1.clear();
+  v2.clear();
+  triangle_index.clear();
+}
+
+size_t PackedTriangles::getMemoryUsage() const {
+  return (v0.capacity() + v1.capacity() + v2.capacity()) * sizeof(Vec3f) +
+         triangle_index.capacity() * sizeof(uint32_t);
+}
+
+void PackedTriangles::push_back(
+    const TriangleMeshResource &mesh, uint32_t index) {
+  v0.push_back(mesh.getVertex(index * 3 + 0));
+  v1.push_back(mesh.getVertex(index * 3 + 1));
+  v2.push_back(mesh.getVertex(index * 3 + 2));
+  triangle_index.push_back(index);
+}
+
+bool PackedTriangles::intersectHit(Ray &ray, uint32_t i,
+    const TriangleMeshResource &mesh, HitRecord &hit) const {
+  if (double_precision)
+    return TriangleIntersectHit(ray, triangle_index[i], mesh, hit);
+
+  Float t;
+  Vec3f b;
+  if (!WatertightTriangleIntersect(ray, v0[i], v1[i], v2[i], &t, &b))
+    return false;
+
+  hit.index = triangle_index[i];
+  hit.b     = b;
+  ray.setTimeMax(t);
+  return true;
+}
+
+bool PackedTriangles::intersect(Ray &ray, uint32_t i,
+    const ref<TriangleMeshResource> &mesh,
+    SurfaceInteraction &interaction) const {
+  HitRecord hit;
+  if (!intersectHit(ray, i, *mesh, hit)) return false;
+
+  CalculateTriangleDifferentials(interaction, hit.b, mesh, hit.index);
+  return true;
+}
+
+bool PackedTriangles::occluded(const Ray &ray, uint32_t i,
+    const ref<TriangleMeshResource> &mesh) const {
+  if (double_precision) {
+    Ray local_ray = ray;
+    HitRecord hit;
+    return TriangleIntersectHit(local_ray, triangle_index[i], *mesh, hit);
+  }
+
+  Float t;
+  Vec3f b;
+  return WatertightTriangleIntersect(ray, v0[i], v1[i], v2[i], &t, &b);
+}
+
+void PackedTriangles::save(std::ostream &stream) const {
+  detail_::WriteCacheSection(stream, v0);
+  detail_::WriteCacheSection(stream, v1);
+  detail_::WriteCacheSection(stream, v2);
+  detail_::WriteCacheSection(stream, triangle_index);
+}
+
+bool PackedTriangles::load(
+    std::istream &stream, const TriangleMeshResource &mesh) {
+  if (!detail_::ReadCacheSection(stream, v0) ||
+      !detail_::ReadCacheSection(stream, v1) ||
+      !detail_::ReadCacheSection(stream, v2) ||
+      !detail_::ReadCacheSection(stream, triangle_index))
+    return false;
+
+  // Spatial splits might reference a triangle more than once
+  const size_t n_triangles = mesh.v_indices.size() / 3;
+  if (v0.size() != triangle_index.size() ||
+      v1.size() != triangle_index.size() ||
+      v2.size() != triangle_index.size() || triangle_index.size() < n_triangles)
+    return false;
+  return std::all_of(triangle_index.begin(), triangle_index.end(),
+      [&](uint32_t index) { return index < n_triangles; });
+}
+
 void Accel::setTriangleMesh(const ref<TriangleMeshResource> &mesh) {
   // Build the bounding box
   AABB bound(Vec3f(Float_INF, Float_INF, Float_INF),
@@ -186,10 +341,62 @@ AABB Accel::getBound() const {
 }
 
 bool Accel::intersect(Ray &ray, SurfaceInteraction &interaction) const {
+  HitRecord hit;
+  if (!intersectHit(ray, hit)) return false;
+
+  computeSurfaceInteraction(hit, interaction);
+  return true;
+}
+
+bool Accel::intersectHit(Ray &ray, HitRecord &hit) const {
   bool success = false;
   for (int i = 0; i < mesh->v_indices.size() / 3; i++)
-    success |= TriangleIntersect(ray, i, mesh, interaction);
+    success |= TriangleIntersectHit(ray, i, *mesh, hit);
   return success;
 }
 
+void Accel::computeSurfaceInteraction(
+    const HitRecord &hit, SurfaceInteraction &interaction) const {
+  CalculateTriangleDifferentials(interaction, hit.b, mesh, hit.index);
+}
+
+bool Accel::occluded(const Ray &ray) const {
+  // The same test as intersectHit(), such that both agree on every ray
+  Ray local_ray = ray;
+  HitRecord hit;
+  for (int i = 0; i < mesh->v_indices.size() / 3; i++)
+    if (TriangleIntersectHit(local_ray, i, *mesh, hit)) return true;
+  return false;
+}
+
+RayMask Accel::intersectPacket(
+    Ray *rays, SurfaceInteraction *interactions, RayMask mask) const {
+  RayMask result = 0;
+  for (int i = 0; i < RAY_PACKET_SIZE; ++i)
+    if (IsRayActive(mask, i) && intersect(rays[i], interactions[i]))
+      result |= RayMask(1) << i;
+  return result;
+}
+
+bool Accel::update() {
+  return false;
+}
+
+size_t Accel::getMemoryUsage() const {
+  return 0;
+}
+
+std::string Accel::getStatistics() const {
+  return {};
+}
+
+bool Accel::save(std::ostream &stream) const {
+  return false;
+}
+
+bool Accel::load(
+    std::istream &stream, const ref<TriangleMeshResource> &mesh) {
+  return false;
+}
+
 RDR_NAMESPACE_END
@@ -10,13 +10,33 @@
 
 #include <cstdlib>
 
+#include "rdr/bvh_cache.h"
 #include "rdr/interaction.h"
 #include "rdr/ray.h"
 #include "rdr/shape.h"
+#include "rdr/wide_bvh_accel.h"
 
 RDR_NAMESPACE_BEGIN
 
+BVHAccel::BVHAccel() {
+  triangle_tree.setHeuristicProfile(
+      decltype(triangle_tree)::EHeuristicProfile::ESurfaceAreaHeuristic);
+}
+
+BVHAccel::BVHAccel(const Properties &props) {
+  detail_::ConfigureBVHTree(triangle_tree, props);
+  triangles.double_precision =
+      props.getProperty<bool>("double_precision", false);
+  max_degradation =
+      props.getProperty<Float>("max_degradation", max_degradation);
+  if (max_degradation < 1)
+    Exception_("Invalid BVH settings: max_degradation = {}, expected >= 1",
+        max_degradation);
+}
+
 void BVHAccel::setTriangleMesh(const ref<TriangleMeshResource> &mesh) {
+  Accel::setTriangleMesh(mesh);
+
   // extract information from mesh
   const uint32_t &num_triangles = mesh->v_indices.size() / 3;
   assert(mesh->v_indices.size() % 3 == 0);
@@ -25,18 +45,113 @@ void BVHAccel::setTriangleMesh(const ref<TriangleMeshResource> &mesh) {
 }
 
 void BVHAccel::build() {
-  triangle_tree.build();
+  if (triangle_tree.getBuildSettings().spatial_split_budget > 0)
+    detail_::BuildSpatialSplitBVH(triangle_tree, mesh);
+  else
+    triangle_tree.build();
+
+  // Gather the triangles in leaf order, see PackedTriangles
+  triangles.clear();
+  for (const auto &node : triangle_tree.getNodes())
+    triangles.push_back(*mesh, node.getData().getTriangleIndex());
 }
 
 AABB BVHAccel::getBound() const {
   return triangle_tree.getAABB();
 }
 
-bool BVHAccel::intersect(Ray &ray, SurfaceInteraction &interaction) const {
-  bool intersected = triangle_tree.intersect(ray,
-      [&interaction](Ray &local_ray, const detail_::Triangle &triangle)
-          -> bool { return triangle.intersect(local_ray, interaction); });
-  return intersected;
+bool BVHAccel::intersectHit(Ray &ray, HitRecord &hit) const {
+  return triangle_tree.intersectLeaves(
+      ray, [&](Ray &local_ray, int span_left, int span_right) -> bool {
+        return intersectLeaf(local_ray, span_left, span_right, hit);
+      });
+}
+
+bool BVHAccel::occluded(const Ray &ray) const {
+  return triangle_tree.occludedLeaves(
+      ray, [&](const Ray &local_ray, int span_left, int span_right) -> bool {
+        return occludedLeaf(local_ray, span_left, span_right);
+      });
+}
+
+RayMask BVHAccel::intersectPacket(
+    Ray *rays, SurfaceInteraction *interactions, RayMask mask) const {
+  HitRecord hits[RAY_PACKET_SIZE];
+  const RayMask result = triangle_tree.intersectPacketLeaves(rays, mask,
+      [&](Ray *local_rays, RayMask active, int span_left,
+          int span_right) -> RayMask {
+        // The triangles of the leaf stay in cache across the packet
+        RayMask result = 0;
+        for (int i = span_left; i < span_right; ++i)
+          for (int j = 0; j < RAY_PACKET_SIZE; ++j)
+            if (IsRayActive(active, j) &&
+                triangles.intersectHit(local_rays[j], i, *mesh, hits[j]))
+              result |= RayMask(1) << j;
+        return result;
+      });
+
+  for (int i = 0; i < RAY_PACKET_SIZE; ++i)
+    if (IsRayActive(result, i))
+      computeSurfaceInteraction(hits[i], interactions[i]);
+  return result;
+}
+
+bool BVHAccel::update() {
+  const int n_rebuilt = triangle_tree.update(max_degradation);
+  if (n_rebuilt > 0)
+    Info_("BVH updated, {} degraded subtrees rebuilt", n_rebuilt);
+
+  // Rebuilt subtrees re-order their triangles, so gather all of them again
+  triangles.clear();
+  for (const auto &node : triangle_tree.getNodes())
+    triangles.push_back(*mesh, node.getData().getTriangleIndex());
+  return true;
+}
+
+size_t BVHAccel::getMemoryUsage() const {
+  using TreeType = decltype(triangle_tree);
+  return triangle_tree.getNodes().capacity() * sizeof(TreeType::NodeType) +
+         triangle_tree.getLinearNodes().capacity() *
+             sizeof(TreeType::LinearNode) +
+         triangles.getMemoryUsage();
+}
+
+std::string BVHAccel::getStatistics() const {
+  return triangle_tree.getStats().toString();
+}
+
+bool BVHAccel::save(std::ostream &stream) const {
+  triangles.save(stream);
+  detail_::WriteCacheSection(stream, triangle_tree.getLinearNodes());
+  return true;
+}
+
+bool BVHAccel::load(
+    std::istream &stream, const ref<TriangleMeshResource> &mesh) {
+  Accel::setTriangleMesh(mesh);
+
+  vector<decltype(triangle_tree)::LinearNode> linear_nodes;
+  if (!triangles.load(stream, *mesh) ||
+      !detail_::ReadCacheSection(stream, linear_nodes))
+    return false;
+
+  // The data nodes are in leaf order as well
+  vector<detail_::BVHTriangleNode> nodes;
+  nodes.reserve(triangles.size());
+  for (const auto &index : triangles.triangle_index)
+    nodes.emplace_back(detail_::Triangle(index, mesh));
+  return triangle_tree.restore(std::move(nodes), std::move(linear_nodes));
+}
+
+ref<Accel> CreateAccel(const Properties &props) {
+  const auto type = props.getProperty<std::string>("type", "bvh");
+  if (type == "bvh") return make_ref<BVHAccel>(props);
+  if (type == "bvh4") return make_ref<WideBVHAccel<4>>(props);
+  if (type == "bvh8") return make_ref<WideBVHAccel<8>>(props);
+#ifdef USE_EMBREE
+  if (type == "embree") return make_ref<ExternalBVHAccel>();
+#endif
+  Exception_("Accel type [ {} ] is not supported", type);
 }
 
 #ifdef USE_EMBREE
@@ -61,6 +176,9 @@ ExternalBVHAccel::~ExternalBVHAccel() {
 }
 
 void ExternalBVHAccel::setTriangleMesh(const ref<TriangleMeshResource> &mesh) {
+  // The hits are completed by Accel::computeSurfaceInteraction
+  Accel::setTriangleMesh(mesh);
+
   // Initialize and set buffers
   float *vertices =
       static_cast<float *>(rtcSetNewGeometryBuffer(geom, RTC_BUFFER_TYPE_VERTEX,
@@ -79,8 +197,6 @@ void ExternalBVHAccel::setTriangleMesh(const ref<TriangleMeshResource> &mesh) {
       vertices, mesh->vertices.data(), sizeof(Vec3f) * mesh->vertices.size());
   std::memcpy(indices, mesh->v_indices.data(),
       sizeof(uint32_t) * mesh->v_indices.size());
-
-  this->mesh = mesh;
 }
 
 void ExternalBVHAccel::build() {
@@ -106,8 +222,7 @@ AABB ExternalBVHAccel::getBound() const {
   return result;
 }
 
-bool ExternalBVHAccel::intersect(
-    Ray &ray, SurfaceInteraction &interaction) const {
+bool ExternalBVHAccel::intersectHit(Ray &ray, HitRecord &hit) const {
   // initialize rayhit struct
   RTCRayHit rayhit;
   rayhit.ray.org_x     = ray.origin.x;
@@ -132,15 +247,33 @@ bool ExternalBVHAccel::intersect(
   // Intersect function should consider ray's timerange
   if (!ray.withinTimeRange(rayhit.ray.tfar)) return false;
 
-  const Float &t  = rayhit.ray.tfar;
   const Vec2f &uv = Vec2f(rayhit.hit.u, rayhit.hit.v);
 
-  const uint32_t triangle_index = rayhit.hit.primID;
-  CalculateTriangleDifferentials(
-      interaction, {1 - uv[0] - uv[1], uv[0], uv[1]}, mesh, triangle_index);
+  hit.index = rayhit.hit.primID;
+  hit.b     = {1 - uv[0] - uv[1], uv[0], uv[1]};
   ray.setTimeMax(rayhit.ray.tfar);
   return true;
 }
+
+bool ExternalBVHAccel::occluded(const Ray &ray) const {
+  RTCRay rtc_ray;
+  rtc_ray.org_x = ray.origin.x;
+  rtc_ray.org_y = ray.origin.y;
+  rtc_ray.org_z = ray.origin.z;
+  rtc_ray.dir_x = ray.direction.x;
+  rtc_ray.dir_y = ray.direction.y;
+  rtc_ray.dir_z = ray.direction.z;
+  rtc_ray.tnear = ray.t_min;
+  rtc_ray.tfar  = ray.t_max;
+  rtc_ray.mask  = -1;
+  rtc_ray.flags = 0;
+
+  AssertAllNormalized(ray.direction);
+  rtcOccluded1(scene, &rtc_ray);
+
+  // tfar is set to -inf if any hit is found
+  return rtc_ray.tfar < 0;
+}
 #endif  // USE_EMBREE
 
 RDR_NAMESPACE_END
@@ -0,0 +1,158 @@
+#include "rdr/bvh_cache.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+
+#include "rdr/accel.h"
+#include "rdr/math_utils.h"
+#include "rdr/shape.h"
+
+RDR_NAMESPACE_BEGIN
+
+namespace {
+struct CacheHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t float_size;
+  uint64_t key;
+};
+
+constexpr char CACHE_MAGIC[8] = {'R', 'D', 'R', 'B', 'V', 'H', '\0', '\0'};
+
+// Whether every corner of the triangles refers to existing data. Normal and
+// texture indices are only read if the mesh has normals or texture coordinates
+bool IsValidCachedMesh(const TriangleMeshResource &mesh) {
+  const auto is_valid_section = [&](const vector<uint32_t> &indices,
+                                    size_t n_elements) {
+    return indices.size() == mesh.v_indices.size() &&
+           std::all_of(indices.begin(), indices.end(),
+               [n_elements](uint32_t index) { return index < n_elements; });
+  };
+
+  return mesh.v_indices.size() % 3 == 0 &&
+         is_valid_section(mesh.v_indices, mesh.vertices.size()) &&
+         (mesh.normals.empty() ||
+             is_valid_section(mesh.n_indices, mesh.normals.size())) &&
+         (mesh.texture_coordinates.empty() ||
+             is_valid_section(
+                 mesh.t_indices, mesh.texture_coordinates.size()));
+}
+}  // namespace
+
+uint64_t HashBytes(const void *data, size_t size, uint64_t seed) {
+  constexpr uint64_t PRIME = 0x9e3779b97f4a7c15ULL;
+  const auto *bytes        = static_cast<const unsigned char *>(data);
+
+  uint64_t hash = seed ^ (size * PRIME);
+  size_t i      = 0;
+  for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+    uint64_t word;
+    std::memcpy(&word, bytes + i, sizeof(word));
+    hash = (hash ^ MixBits(word)) * PRIME;
+  }
+
+  uint64_t tail = 0;
+  std::memcpy(&tail, bytes + i, size - i);
+  return MixBits(hash ^ MixBits(tail));
+}
+
+uint64_t HashFile(const fs::path &path) {
+  std::ifstream stream(path, std::ios::binary);
+  if (!stream) Exception_("Cannot read [ {} ] for hashing", path.string());
+
+  // Chunks are of fixed size, so the hash only depends on the content
+  vector<char> buffer(1 << 20);
+  uint64_t hash = 0;
+  while (stream) {
+    stream.read(buffer.data(), buffer.size());
+    hash = HashBytes(buffer.data(), stream.gcount(), hash);
+  }
+
+  return hash;
+}
+
+BVHCache::BVHCache(const fs::path &directory, uint64_t key)
+    : path(directory / format("{:016x}.bvh", key)), key(key) {}
+
+fs::path BVHCache::GetDefaultDirectory() {
+  return fs::temp_directory_path() / "rdr_bvh_cache";
+}
+
+bool BVHCache::load(
+    const ref<TriangleMeshResource> &mesh, Accel &accel) const {
+  std::ifstream stream(path, std::ios::binary);
+  if (!stream) return false;
+
+  CacheHeader header{};
+  stream.read(reinterpret_cast<char *>(&header), sizeof(header));
+  if (!stream || std::memcmp(header.magic, CACHE_MAGIC, 8) != 0 ||
+      header.version != VERSION || header.float_size != sizeof(Float) ||
+      header.key != key) {
+    Warn_("Ignoring stale BVH cache [ {} ]", path.string());
+    return false;
+  }
+
+  // ref only exposes a const resource through a const handle
+  auto &resource     = *mesh.get();
+  const bool success = detail_::ReadCacheSection(stream, resource.vertices) &&
+                       detail_::ReadCacheSection(stream, resource.normals) &&
+                       detail_::ReadCacheSection(
+                           stream, resource.texture_coordinates) &&
+                       detail_::ReadCacheSection(stream, resource.v_indices) &&
+                       detail_::ReadCacheSection(stream, resource.n_indices) &&
+                       detail_::ReadCacheSection(stream, resource.t_indices) &&
+                       IsValidCachedMesh(resource) && accel.load(stream, mesh);
+  if (!success) {
+    Warn_("Ignoring corrupted BVH cache [ {} ]", path.string());
+    resource = TriangleMeshResource();
+    return false;
+  }
+
+  resource.has_normal  = !resource.normals.empty();
+  resource.has_texture = !resource.texture_coordinates.empty();
+  Info_("BVH cache loaded from [ {} ]", path.string());
+  return true;
+}
+
+bool BVHCache::save(
+    const TriangleMeshResource &mesh, const Accel &accel) const {
+  std::error_code error;
+  fs::create_directories(path.parent_path(), error);
+
+  // Write to a temporary file first, such that a crash or a concurrent
+  // launch never observes a partially written cache
+  const fs::path temp_path = fs::path(path).concat(".tmp");
+  std::ofstream stream(temp_path, std::ios::binary | std::ios::trunc);
+  if (!stream) {
+    Warn_("Cannot write BVH cache [ {} ]", temp_path.string());
+    return false;
+  }
+
+  CacheHeader header{};
+  std::memcpy(header.magic, CACHE_MAGIC, 8);
+  header.version    = VERSION;
+  header.float_size = sizeof(Float);
+  header.key        = key;
+  stream.write(reinterpret_cast<const char *>(&header), sizeof(header));
+
+  detail_::WriteCacheSection(stream, mesh.vertices);
+  detail_::WriteCacheSection(stream, mesh.normals);
+  detail_::WriteCacheSection(stream, mesh.texture_coordinates);
+  detail_::WriteCacheSection(stream, mesh.v_indices);
+  detail_::WriteCacheSection(stream, mesh.n_indices);
+  detail_::WriteCacheSection(stream, mesh.t_indices);
+  const bool success = accel.save(stream) && stream.flush();
+  stream.close();
+
+  if (success) fs::rename(temp_path, path, error);
+  if (!success || error) {
+    fs::remove(temp_path, error);
+    return false;
+  }
+
+  Info_("BVH cache saved to [ {} ]", path.string());
+  return true;
+}
+
+RDR_NAMESPACE_END
@@ -1,5 +1,11 @@
 #include "rdr/film.h"
 
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <numeric>
+
+#include "rdr/bvh_cache.h"
 #include "rdr/platform.h"
 
 /// Do not change the order of these includes
@@ -90,6 +96,28 @@ static bool SaveEXR(
   return true;
 }
 
+/* ===================================================================== *
+ *
+ * Checkpoint related
+ *
+ * ===================================================================== */
+
+namespace {
+struct CheckpointHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t float_size;
+  Vec2i resolution;
+  FilmCheckpoint checkpoint;
+};
+
+constexpr char CHECKPOINT_MAGIC[8] = {
+    'R', 'D', 'R', 'F', 'I', 'L', 'M', '\0'};
+
+/// Bump this whenever the layout of the checkpoint changes
+constexpr uint32_t CHECKPOINT_VERSION = 2;
+}  // namespace
+
 /* ===================================================================== *
  *
  *  Film Implementations
@@ -101,6 +129,7 @@ Film::Film(const Properties &props)
       block_side_length(props.getProperty<int>("block_side_length", 16)),
       data(resolution.x * resolution.y),
       weight(resolution.x * resolution.y),
+      moments(resolution.x * resolution.y),
       light_data(resolution.x * resolution.y) {
   if (block_side_length <= 0) {
     Exception_("block side length should be greater equal than 1");
@@ -112,6 +141,8 @@ void Film::crossConfiguration(const CrossConfigurationContext &context) {
 }
 
 void Film::preprocess(const PreprocessContext &context) {
+  filter_table = FilterTable(*filter);
+
   // build the FilmBlockView table
   block_resolution.x = std::ceil(
       static_cast<Float>(resolution.x) / static_cast<Float>(block_side_length));
@@ -150,6 +181,7 @@ const Vec3f &Film::getPixel(int x, int y) const {
 void Film::clear() {
   std::fill(data.begin(), data.end(), Vec3f(0.0));
   std::fill(weight.begin(), weight.end(), 0.0);
+  std::fill(moments.begin(), moments.end(), PixelMoments());
   std::fill(light_data.begin(), light_data.end(), Vec3f(0.0));
 }
 
@@ -174,31 +206,34 @@ void Film::exportImageToFile(const fs::path &path_name) const {
     stbi_write_png(
         file_name.c_str(), resolution.x, resolution.y, 3, rgb_data.data(), 0);
   } else {
-    vector<float> rgb_data(resolution.x * resolution.y * 3);
-
-    for (int y = 0; y < resolution.y; y++) {
-      for (int x = 0; x < resolution.x; x++) {
-        int flipped_y     = resolution.y - 1 - y;
-        int index         = x + y * resolution.x;
-        int flipped_index = x + flipped_y * resolution.x;
-
-        const Float &filter_weight = weight[index];
-        if (filter_weight == 0) {
-          rgb_data[3 * flipped_index]     = light_data[index].x;
-          rgb_data[3 * flipped_index + 1] = light_data[index].y;
-          rgb_data[3 * flipped_index + 2] = light_data[index].z;
-        } else {
-          rgb_data[3 * flipped_index] =
-              data[index].x / filter_weight + light_data[index].x;
-          rgb_data[3 * flipped_index + 1] =
-              data[index].y / filter_weight + light_data[index].y;
-          rgb_data[3 * flipped_index + 2] =
-              data[index].z / filter_weight + light_data[index].z;
-        }
+    vector<float> rgb_data;
+    resolveToRGB(rgb_data);
+    SaveEXR(rgb_data.data(), resolution.x, resolution.y, file_name.c_str());
+  }
+}
+
+void Film::resolveToRGB(vector<float> &rgb_data) const {
+  rgb_data.resize(resolution.x * resolution.y * 3);
+  for (int y = 0; y < resolution.y; y++) {
+    for (int x = 0; x < resolution.x; x++) {
+      int flipped_y     = resolution.y - 1 - y;
+      int index         = x + y * resolution.x;
+      int flipped_index = x + flipped_y * resolution.x;
+
+      const Float &filter_weight = weight[index];
+      if (filter_weight == 0) {
+        rgb_data[3 * flipped_index]     = light_data[index].x;
+        rgb_data[3 * flipped_index + 1] = light_data[index].y;
+        rgb_data[3 * flipped_index + 2] = light_data[index].z;
+      } else {
+        rgb_data[3 * flipped_index] =
+            data[index].x / filter_weight + light_data[index].x;
+        rgb_data[3 * flipped_index + 1] =
+            data[index].y / filter_weight + light_data[index].y;
+        rgb_data[3 * flipped_index + 2] =
+            data[index].z / filter_weight + light_data[index].z;
       }
     }
-
-    SaveEXR(rgb_data.data(), resolution.x, resolution.y, file_name.c_str());
   }
 }
 
@@ -210,6 +245,101 @@ void Film::commitSample(const Vec2f &sample_pos, const Vec3f &measurement) {
       });
 }
 
+void Film::mergeTile(const FilmTile &tile) {
+  std::scoped_lock<std::mutex> lock(*merge_lock);
+  for (int y = 0; y < tile.padded_size.y; ++y) {
+    for (int x = 0; x < tile.padded_size.x; ++x) {
+      const int local_index = x + y * tile.padded_size.x;
+      const Vec2i pixel     = tile.padded_offset + Vec2i(x, y);
+      getPixel(pixel.x, pixel.y) += tile.data[local_index];
+      getWeight(pixel.x, pixel.y) += tile.weight[local_index];
+    }
+  }
+
+  for (int y = 0; y < tile.size.y; ++y) {
+    for (int x = 0; x < tile.size.x; ++x) {
+      const Vec2i pixel = tile.offset + Vec2i(x, y);
+      moments[pixel.x + resolution.x * pixel.y].merge(
+          tile.moments[x + y * tile.size.x]);
+    }
+  }
+}
+
+bool Film::saveCheckpoint(
+    const fs::path &path, const FilmCheckpoint &checkpoint) const {
+  // Same layout and write-then-rename as BVHCache::save
+  const fs::path temp_path = fs::path(path).concat(".tmp");
+  std::ofstream stream(temp_path, std::ios::binary | std::ios::trunc);
+  if (!stream) {
+    Warn_("Cannot write checkpoint [ {} ]", temp_path.string());
+    return false;
+  }
+
+  CheckpointHeader header{};
+  std::memcpy(header.magic, CHECKPOINT_MAGIC, 8);
+  header.version    = CHECKPOINT_VERSION;
+  header.float_size = sizeof(Float);
+  header.resolution = resolution;
+  header.checkpoint = checkpoint;
+  stream.write(reinterpret_cast<const char *>(&header), sizeof(header));
+
+  detail_::WriteCacheSection(stream, data);
+  detail_::WriteCacheSection(stream, weight);
+  detail_::WriteCacheSection(stream, light_data);
+  detail_::WriteCacheSection(stream, moments);
+  const bool success = static_cast<bool>(stream.flush());
+  stream.close();
+
+  std::error_code error;
+  if (success) fs::rename(temp_path, path, error);
+  if (!success || error) {
+    Warn_("Cannot write checkpoint [ {} ]", path.string());
+    fs::remove(temp_path, error);
+    return false;
+  }
+
+  Info_("Checkpoint of {} spp saved to [ {} ]", checkpoint.samples,
+      path.string());
+  return true;
+}
+
+FilmCheckpoint Film::loadCheckpoint(const fs::path &path) {
+  std::ifstream stream(path, std::ios::binary);
+  if (!stream) Exception_("Cannot open checkpoint [ {} ]", path.string());
+
+  CheckpointHeader header{};
+  stream.read(reinterpret_cast<char *>(&header), sizeof(header));
+  if (!stream || std::memcmp(header.magic, CHECKPOINT_MAGIC, 8) != 0 ||
+      header.version != CHECKPOINT_VERSION ||
+      header.float_size != sizeof(Float))
+    Exception_("[ {} ] is not a checkpoint of this renderer", path.string());
+  if (header.resolution != resolution)
+    Exception_("Checkpoint [ {} ] is of resolution {}, but the film is {}",
+        path.string(), header.resolution, resolution);
+
+  // Read into temporaries, such that a corrupted file leaves the film intact
+  vector<Vec3f> checkpoint_data, checkpoint_light_data;
+  vector<Double> checkpoint_weight;
+  vector<PixelMoments> checkpoint_moments;
+  if (!detail_::ReadCacheSection(stream, checkpoint_data) ||
+      !detail_::ReadCacheSection(stream, checkpoint_weight) ||
+      !detail_::ReadCacheSection(stream, checkpoint_light_data) ||
+      !detail_::ReadCacheSection(stream, checkpoint_moments) ||
+      checkpoint_data.size() != data.size() ||
+      checkpoint_weight.size() != weight.size() ||
+      checkpoint_light_data.size() != light_data.size() ||
+      checkpoint_moments.size() != moments.size())
+    Exception_("Checkpoint [ {} ] is corrupted", path.string());
+
+  data       = std::move(checkpoint_data);
+  weight     = std::move(checkpoint_weight);
+  light_data = std::move(checkpoint_light_data);
+  moments    = std::move(checkpoint_moments);
+  Info_("Checkpoint of {} spp loaded from [ {} ]", header.checkpoint.samples,
+      path.string());
+  return header.checkpoint;
+}
+
 void Film::commitLightImageSplat(
     const Vec2f &sample_pos, const Vec3f &measurement) {
   if (!isInside(sample_pos)) return;
@@ -220,6 +350,161 @@ void Film::commitLightImageSplat(
   block_views[block_index].commitLightImageSplat(sample_pos, measurement);
 }
 
+// =======================================================================
+// FilmTile Implementation
+// =======================================================================
+
+namespace {
+/// Spread the lowest 16 bits of v such that there is a zero between bits
+uint32_t ExpandBitsBy2(uint32_t v) {
+  v &= 0xffffU;
+  v = (v | v << 8) & 0x00ff00ffU;
+  v = (v | v << 4) & 0x0f0f0f0fU;
+  v = (v | v << 2) & 0x33333333U;
+  v = (v | v << 1) & 0x55555555U;
+  return v;
+}
+
+uint32_t EncodeMorton2(uint32_t x, uint32_t y) {
+  return (ExpandBitsBy2(y) << 1) | ExpandBitsBy2(x);
+}
+
+/// Distance of (x, y) along the Hilbert curve over the n x n grid, where n is
+/// a power of two. See https://en.wikipedia.org/wiki/Hilbert_curve
+uint64_t EncodeHilbert2(uint32_t n, uint32_t x, uint32_t y) {
+  uint64_t d = 0;
+  for (uint32_t s = n / 2; s > 0; s /= 2) {
+    const uint32_t rx = (x & s) > 0 ? 1 : 0;
+    const uint32_t ry = (y & s) > 0 ? 1 : 0;
+    d += static_cast<uint64_t>(s) * s * ((3 * rx) ^ ry);
+
+    // Rotate the quadrant, such that the curve is continuous
+    if (ry == 0) {
+      if (rx == 1) {
+        x = n - 1 - x;
+        y = n - 1 - y;
+      }
+      std::swap(x, y);
+    }
+  }
+  return d;
+}
+}  // namespace
+
+vector<int> GetTileOrder(const Vec2i &n_tiles, ETileOrder order) {
+  vector<int> tiles(n_tiles.x * n_tiles.y);
+  std::iota(tiles.begin(), tiles.end(), 0);
+  if (order == ETileOrder::EScanline) return tiles;
+
+  // Both curves are defined on the power-of-two grid covering all tiles, the
+  // tiles outside of the film are just skipped
+  uint32_t n = 1;
+  while (n < static_cast<uint32_t>(Max(n_tiles.x, n_tiles.y))) n *= 2;
+
+  vector<uint64_t> keys(tiles.size());
+  for (int tile : tiles) {
+    const auto x = static_cast<uint32_t>(tile % n_tiles.x);
+    const auto y = static_cast<uint32_t>(tile / n_tiles.x);
+    keys[tile] = order == ETileOrder::EMorton ? EncodeMorton2(x, y)
+                                              : EncodeHilbert2(n, x, y);
+  }
+  std::sort(tiles.begin(), tiles.end(),
+      [&keys](int a, int b) { return keys[a] < keys[b]; });
+  return tiles;
+}
+
+FilmTile::FilmTile(const Film &film, const Vec2i &offset, const Vec2i &size)
+    : filter_table(&film.filter_table),
+      discrete_radius(std::ceil(film.filter_table.getRadius() - 0.5)),
+      resolution(film.getResolution()),
+      offset(offset),
+      size(size) {
+  const Vec2i padded_end =
+      Min(offset + size + Vec2i(discrete_radius), resolution);
+  padded_offset = Max(offset - Vec2i(discrete_radius), Vec2i(0));
+  padded_size   = padded_end - padded_offset;
+  data.assign(padded_size.x * padded_size.y, Vec3f(0.0));
+  weight.assign(padded_size.x * padded_size.y, 0.0);
+  moments.assign(size.x * size.y, PixelMoments());
+}
+
+void FilmTile::commitSample(
+    const Vec2f &sample_pos, const Vec3f &measurement) {
+  // Pixel samples may round up onto the upper edge of the tile, they belong
+  // to the last pixel, whose footprint the padded buffer covers as a whole
+  const Vec2i sample_index(std::floor(sample_pos.x), std::floor(sample_pos.y));
+  assert(sample_index.x >= offset.x && sample_index.x <= offset.x + size.x);
+  assert(sample_index.y >= offset.y && sample_index.y <= offset.y + size.y);
+  const Vec2i pixel_index = Min(sample_index, offset + size - Vec2i(1));
+
+  const Vec2i moment_index = pixel_index - offset;
+  moments[moment_index.x + moment_index.y * size.x].add(
+      Luminance(measurement));
+
+  // Same as FilmBlockView::commitSample, but only the pixels in the padded
+  // buffer are visited. It covers the whole footprint inside the film
+  const Vec2i padded_end = padded_offset + padded_size;
+  for (int x = -discrete_radius; x <= discrete_radius; ++x) {
+    const int pixel_x = pixel_index.x + x;
+    if (pixel_x < padded_offset.x || pixel_x >= padded_end.x) continue;
+    const Float weight_x =
+        filter_table->evaluate1D(sample_pos.x - pixel_x - 0.5_F);
+    for (int y = -discrete_radius; y <= discrete_radius; ++y) {
+      const int pixel_y = pixel_index.y + y;
+      if (pixel_y < padded_offset.y || pixel_y >= padded_end.y) continue;
+      const Float &pixel_weight =
+          weight_x * filter_table->evaluate1D(sample_pos.y - pixel_y - 0.5_F);
+      const int index = (pixel_x - padded_offset.x) +
+                        (pixel_y - padded_offset.y) * padded_size.x;
+      weight[index] += pixel_weight;
+      data[index] += measurement * pixel_weight;
+    }
+  }
+}
+
+// =======================================================================
+// FilmSnapshotWriter Implementation
+// =======================================================================
+
+FilmSnapshotWriter::FilmSnapshotWriter(
+    const Film &film, fs::path path, Float interval)
+    : film(film),
+      path(std::move(path)),
+      interval(interval),
+      writer([this]() { run(); }) {}
+
+FilmSnapshotWriter::~FilmSnapshotWriter() {
+  {
+    std::scoped_lock<std::mutex> lock(stop_lock);
+    stopped = true;
+  }
+  stop_requested.notify_all();
+  writer.join();
+}
+
+void FilmSnapshotWriter::run() {
+  const std::string file_name = path.string();
+  const std::chrono::duration<Float> period(interval);
+
+  std::unique_lock<std::mutex> lock(stop_lock);
+  while (!stop_requested.wait_for(lock, period, [this] { return stopped; })) {
+    lock.unlock();
+    {
+      std::scoped_lock<std::mutex> merge_lock(*film.merge_lock.get());
+      film.resolveToRGB(rgb_data);
+    }
+
+    // Never let a failed write take the render down
+    try {
+      SaveEXR(rgb_data.data(), film.resolution.x, film.resolution.y,
+          file_name.c_str());
+    } catch (const rdr_exception &e) {
+      Warn_("Failed to write the snapshot: {}", e.what());
+    }
+    lock.lock();
+  }
+}
+
 // =======================================================================
 // FilmBlockView Implementation
 // =======================================================================
@@ -230,23 +515,31 @@ void FilmBlockView::commitSample(
   // lock the local block when committing the sample
   std::scoped_lock<std::mutex> lock(*local_lock);
 
-  const auto &filter         = film.filter;
-  const Float &filter_radius = filter->getRadius();
-  const int &discrete_radius = std::ceil(filter_radius - 0.5);
+  const FilterTable &filter_table = film.filter_table;
+  const Float &filter_radius      = filter_table.getRadius();
+  const int &discrete_radius      = std::ceil(filter_radius - 0.5);
 
   // Find the corresponding pixel
   AssertAllNonNegative(sample_pos.x, sample_pos.y);
   const Vec2i pixel_index(std::floor(sample_pos.x), std::floor(sample_pos.y));
 
-  // traverse the pixels in the filter window
+  // Only the block of the pixel of the sample counts its moments
+  if (isInside(pixel_index))
+    film.moments[pixel_index.x + film.resolution.x * pixel_index.y].add(
+        Luminance(measurement));
+
+  // traverse the pixels in the filter window, the filter is separable so the
+  // horizontal factor is shared by a column
   for (int x = -discrete_radius; x <= discrete_radius; ++x) {
+    const Float weight_x = filter_table.evaluate1D(
+        sample_pos.x - (pixel_index.x + x) - static_cast<Float>(0.5));
     for (int y = -discrete_radius; y <= discrete_radius; ++y) {
       const Vec2i &current_pixel_index = pixel_index + Vec2i(x, y);
       if (!isInside(current_pixel_index)) continue;
-      const Vec2f &relative_pos = sample_pos -
-                                  Cast<Float>(current_pixel_index) -
-                                  static_cast<Float>(0.5);
-      const Float &weight = filter->evaluate(relative_pos);
+      const Float &weight =
+          weight_x * filter_table.evaluate1D(sample_pos.y -
+                                             current_pixel_index.y -
+                                             static_cast<Float>(0.5));
       film.getWeight(current_pixel_index.x, current_pixel_index.y) += weight;
       film.getPixel(current_pixel_index.x, current_pixel_index.y) +=
           measurement * weight;
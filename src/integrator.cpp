@@ -2,6 +2,8 @@
 
 #include <omp.h>
 
+#include <chrono>
+
 #include "rdr/bsdf.h"
 #include "rdr/camera.h"
 #include "rdr/canary.h"
@@ -29,69 +31,268 @@ void IntersectionTestIntegrator::render(ref<Camera> camera, ref<Scene> scene) {
   // Statistics
   std::atomic<int> cnt = 0;
 
-  const Vec2i &resolution = camera->getFilm()->getResolution();
+  auto &film              = camera->getFilm();
+  const Vec2i &resolution = film->getResolution();
+
+  if (progressive) {
+    renderProgressive(camera, scene);
+    return;
+  }
+
+  if (adaptive_threshold > 0) {
+    renderAdaptive(camera, scene);
+    return;
+  }
 
   print("Rendering with spp = {}\n", spp);
-#pragma omp parallel for schedule(dynamic)
-  for (int dx = 0; dx < resolution.x; dx++) {
-    ++cnt;
-    if (cnt % (resolution.x / 10) == 0)
-      Info_("Rendering: {:.02f}%", cnt * 100.0 / resolution.x);
-    Sampler sampler;
-    for (int dy = 0; dy < resolution.y; dy++) {
-      sampler.setPixelIndex2D(Vec2i(dx, dy));
-      for (int sample = 0; sample < spp; sample++) {
-        // TODO(HW3): generate #spp rays for each pixel and use Monte Carlo
-        // integration to compute radiance.
-        //
-        // Useful Functions:
-        //
-        // @see Sampler::getPixelSample for getting the current pixel sample
-        // as Vec2f.
-        //
-        // @see Camera::generateDifferentialRay for generating rays given
-        // pixel sample positions as 2 floats.
-
-        // You should assign the following two variables
-        // const Vec2f &pixel_sample = ...
-        // auto ray = ...
-
-        // After you assign pixel_sample and ray, you can uncomment the
-        // following lines to accumulate the radiance to the film.
-        //
-        //
-        // Accumulate radiance
-        // assert(pixel_sample.x >= dx && pixel_sample.x <= dx + 1);
-        // assert(pixel_sample.y >= dy && pixel_sample.y <= dy + 1);
-        // const Vec3f &L = Li(scene, ray, sampler);
-        // camera->getFilm()->commitSample(pixel_sample, L);
-        // UNIMPLEMENTED;
-        // My implementation
-        const Vec2f &pixel_sample = sampler.getPixelSample();
-        auto ray =
-            camera->generateDifferentialRay(pixel_sample.x, pixel_sample.y);
-        // Accumulate radiance
-        assert(pixel_sample.x >= dx && pixel_sample.x <= dx + 1);
-        assert(pixel_sample.y >= dy && pixel_sample.y <= dy + 1);
-        const Vec3f &L = Li(scene, ray, sampler);
-        camera->getFilm()->commitSample(pixel_sample, L);
+  if (!tiled) {
+    const auto render_column = [&](int dx, Sampler &sampler) {
+      sampler.setType(sampler_type, spp);
+      ++cnt;
+      if (cnt % (resolution.x / 10) == 0)
+        Info_("Rendering: {:.02f}%", cnt * 100.0 / resolution.x);
+      for (int dy = 0; dy < resolution.y; dy++)
+        renderPixel(camera, scene, sampler, Vec2i(dx, dy), spp, *film);
+    };
+    ParallelExecute<Sampler>(executor, 0, resolution.x, render_column);
+    return;
+  }
+
+  renderTiles(camera, scene, 0, spp);
+}
+
+void IntersectionTestIntegrator::renderProgressive(
+    ref<Camera> camera, ref<Scene> scene) {
+  using Clock = std::chrono::steady_clock;
+
+  const auto start   = Clock::now();
+  const auto elapsed = [start]() {
+    return std::chrono::duration<double>(Clock::now() - start).count();
+  };
+
+  auto &film = camera->getFilm();
+  if (time_limit > 0)
+    print("Rendering progressively for {}s\n", time_limit);
+  else
+    print("Rendering progressively with spp = {}\n", spp);
+
+  std::optional<FilmSnapshotWriter> snapshot_writer;
+  if (snapshot_interval > 0)
+    snapshot_writer.emplace(*film, FileResolver::resolveToAbs(snapshot_path),
+        snapshot_interval);
+
+  FilmCheckpoint checkpoint;
+  const std::string checkpoint_file =
+      checkpoint_path.empty() ? ""
+                              : FileResolver::resolveToAbs(checkpoint_path);
+  if (resume && fs::exists(checkpoint_file)) {
+    checkpoint = film->loadCheckpoint(checkpoint_file);
+  } else if (resume) {
+    Warn_("Checkpoint [ {} ] not found, rendering from scratch",
+        checkpoint_file);
+  }
+
+  // Every pass renders as many samples as all of the previous ones, unless
+  // the remaining time budget only fits fewer of them
+  const int start_samples = checkpoint.samples;
+  while (true) {
+    const int done = checkpoint.samples;
+    int pass_spp   = Max(done, 1);
+    if (time_limit > 0) {
+      // Estimate the cost of a sample per pixel by this launch only, since
+      // a resumed checkpoint might come from another machine
+      if (done > start_samples) {
+        const double spp_time = elapsed() / (done - start_samples);
+        const int fit = static_cast<int>((time_limit - elapsed()) / spp_time);
+        if (fit < 1) break;
+        pass_spp = Min(pass_spp, fit);
+      } else {
+        pass_spp = 1;
+      }
+    } else {
+      if (done >= spp) break;
+      pass_spp = Min(pass_spp, spp - done);
+    }
+
+    renderTiles(camera, scene, checkpoint.pass, pass_spp);
+    checkpoint.pass++;
+    checkpoint.samples += pass_spp;
+    Info_("Progressive pass {} finished with {} spp in {:.2f}s",
+        checkpoint.pass - 1, checkpoint.samples, elapsed());
+    if (!checkpoint_file.empty())
+      film->saveCheckpoint(checkpoint_file, checkpoint);
+  }
+
+  // Samples of this launch only, @see FilmCheckpoint
+  const Vec2i &resolution = film->getResolution();
+  const double seconds    = elapsed();
+  const double n_samples  = static_cast<double>(resolution.x) *
+                           resolution.y * (checkpoint.samples - start_samples);
+  Info_("Rendered {} spp in total, {} spp in {:.2f}s at {:.4g} samples/s",
+      checkpoint.samples, checkpoint.samples - start_samples, seconds,
+      n_samples / seconds);
+}
+
+void IntersectionTestIntegrator::renderAdaptive(
+    ref<Camera> camera, ref<Scene> scene) {
+  auto &film              = camera->getFilm();
+  const Vec2i &resolution = film->getResolution();
+  const int n_pixels      = resolution.x * resolution.y;
+  print("Rendering adaptively with spp = {} down to a relative error of {}\n",
+      spp, adaptive_threshold);
+
+  // The same number of samples as rendering spp everywhere, the samples of
+  // the pixels converged early go to the noisy ones
+  const int min_spp = Min(adaptive_min_spp, spp);
+  int64_t budget    = static_cast<int64_t>(spp - min_spp) * n_pixels;
+  renderTiles(camera, scene, 0, min_spp);
+
+  // Every pass doubles the samples of the pixels still above the threshold,
+  // as far as the budget allows
+  vector<bool> active(n_pixels);
+  int rendered = min_spp;
+  for (int pass = 1; budget > 0; ++pass) {
+    int64_t n_active = 0;
+    for (int y = 0; y < resolution.y; ++y) {
+      for (int x = 0; x < resolution.x; ++x) {
+        const bool noisy = film->getMoments(x, y).getRelativeError() >
+                           adaptive_threshold;
+        active[x + y * resolution.x] = noisy;
+        n_active += noisy ? 1 : 0;
       }
     }
+
+    const int64_t affordable = budget / Max(n_active, int64_t(1));
+    const auto pass_spp =
+        static_cast<int>(Min(static_cast<int64_t>(rendered), affordable));
+    if (n_active == 0 || pass_spp == 0) break;
+
+    Info_("Adaptive pass {}: {} spp to {:.2f}% of the pixels", pass, pass_spp,
+        n_active * 100.0 / n_pixels);
+    renderTiles(camera, scene, pass, pass_spp, &active);
+    budget   -= n_active * pass_spp;
+    rendered += pass_spp;
+  }
+
+  Info_("Rendered {:.2f} spp on average, {} spp at most",
+      spp - static_cast<double>(budget) / n_pixels, rendered);
+}
+
+void IntersectionTestIntegrator::renderTiles(ref<Camera> camera,
+    ref<Scene> scene, int pass, int n_samples,
+    const vector<bool> *active) const {
+  // Statistics
+  std::atomic<int> cnt = 0;
+
+  auto &film              = camera->getFilm();
+  const Vec2i &resolution = film->getResolution();
+
+  // Each tile is accumulated privately and merged once, see FilmTile
+  const int side      = tile_size > 0 ? tile_size : film->getBlockSideLength();
+  const Vec2i n_tiles = (resolution + Vec2i(side - 1)) / side;
+  const int total     = n_tiles.x * n_tiles.y;
+
+  const vector<int> order = GetTileOrder(n_tiles, tile_order);
+
+  // Workers start on contiguous runs of the order, i.e. compact regions
+  const auto render_tile = [&](int task, Sampler &sampler) {
+    const int tile_index = order[task];
+    const Vec2i offset =
+        Vec2i(tile_index % n_tiles.x, tile_index / n_tiles.x) * side;
+    const Vec2i size = Min(Vec2i(side), resolution - offset);
+    const auto is_active = [&](int dx, int dy) {
+      return active == nullptr || (*active)[dx + dy * resolution.x];
+    };
+
+    // Tiles without any active pixel are not even merged
+    bool any_active = false;
+    for (int dy = offset.y; dy < offset.y + size.y && !any_active; dy++)
+      for (int dx = offset.x; dx < offset.x + size.x && !any_active; dx++)
+        any_active = is_active(dx, dy);
+
+    if (any_active) {
+      FilmTile tile(*film, offset, size);
+
+      // Passes must not repeat the samples of each other
+      sampler.setType(sampler_type, n_samples);
+      sampler.setSeed(pass);
+      for (int dy = offset.y; dy < offset.y + size.y; dy++)
+        for (int dx = offset.x; dx < offset.x + size.x; dx++)
+          if (is_active(dx, dy))
+            renderPixel(
+                camera, scene, sampler, Vec2i(dx, dy), n_samples, tile);
+      film->mergeTile(tile);
+    }
+
+    ++cnt;
+    if (!progressive && active == nullptr &&
+        cnt % std::max(total / 10, 1) == 0)
+      Info_("Rendering: {:.02f}%", cnt * 100.0 / total);
+  };
+  ParallelExecute<Sampler>(executor, 0, total, render_tile);
+}
+
+template <typename Target>
+void IntersectionTestIntegrator::renderPixel(ref<Camera> camera,
+    ref<Scene> scene, Sampler &sampler, const Vec2i &pixel, int n_samples,
+    Target &target) const {
+  const int dx = pixel.x, dy = pixel.y;
+  sampler.setPixelIndex2D(pixel);
+
+  // The camera rays of a pixel are coherent, so their first hits are found
+  // by packets
+  for (int first = 0; first < n_samples; first += RAY_PACKET_SIZE) {
+    const int size = Min(RAY_PACKET_SIZE, n_samples - first);
+    Vec2f pixel_samples[RAY_PACKET_SIZE];
+    DifferentialRay rays[RAY_PACKET_SIZE];
+    Ray packet_rays[RAY_PACKET_SIZE];
+    SurfaceInteraction interactions[RAY_PACKET_SIZE];
+
+    for (int sample = 0; sample < size; sample++) {
+      sampler.startPixelSample(first + sample);
+      pixel_samples[sample] = sampler.getPixelSample();
+      rays[sample]          = camera->generateDifferentialRay(
+          pixel_samples[sample].x, pixel_samples[sample].y);
+      packet_rays[sample] = rays[sample];
+    }
+
+    const RayMask hits = scene->intersectPacket(
+        packet_rays, interactions, (RayMask(1) << size) - 1);
+    for (int sample = 0; sample < size; sample++) {
+      // Resume the numbers of the sample after its pixel sample
+      sampler.startPixelSample(first + sample, 2);
+      const Vec2f &pixel_sample = pixel_samples[sample];
+      // Accumulate radiance
+      assert(pixel_sample.x >= dx && pixel_sample.x <= dx + 1);
+      assert(pixel_sample.y >= dy && pixel_sample.y <= dy + 1);
+      const Vec3f &L = Li(scene, rays[sample], sampler,
+          IsRayActive(hits, sample), interactions[sample]);
+      target.commitSample(pixel_sample, L);
+    }
   }
 }
 
 Vec3f IntersectionTestIntegrator::Li(
     ref<Scene> scene, DifferentialRay &ray, Sampler &sampler) const {
+  SurfaceInteraction interaction;
+  const bool intersected = scene->intersect(ray, interaction);
+  return Li(scene, ray, sampler, intersected, interaction);
+}
+
+Vec3f IntersectionTestIntegrator::Li(ref<Scene> scene, DifferentialRay &ray,
+    Sampler &sampler, bool intersected, SurfaceInteraction interaction) const {
   Vec3f color(0.0);
 
   // Cast a ray until we hit a non-specular surface or miss
   // Record whether we have found a diffuse surface
   bool diffuse_found = false;
-  SurfaceInteraction interaction;
 
   for (int i = 0; i < max_depth; ++i) {
-    interaction      = SurfaceInteraction();
-    bool intersected = scene->intersect(ray, interaction);
+    // The first intersection is given
+    if (i > 0) {
+      interaction = SurfaceInteraction();
+      intersected = scene->intersect(ray, interaction);
+    }
 
     // Perform RTTI to determine the type of the surface
     bool is_ideal_diffuse =
@@ -148,7 +349,6 @@ Vec3f IntersectionTestIntegrator::directLighting(
   Vec3f color(0, 0, 0);
   Float dist_to_light = Norm(point_light_position - interaction.p);
   Vec3f light_dir     = Normalize(point_light_position - interaction.p);
-  auto test_ray       = DifferentialRay(interaction.p, light_dir);
 
   // TODO(HW3): Test for occlusion
   //
@@ -167,9 +367,10 @@ Vec3f IntersectionTestIntegrator::directLighting(
   //
   // UNIMPLEMENTED;
   // My implementation
-  SurfaceInteraction temp_interaction;
-  bool occluded = scene->intersect(test_ray, temp_interaction);
-  if (occluded && Norm(temp_interaction.p - interaction.p) < dist_to_light) {
+  // Any hit before the light blocks it, so the closest one is not needed
+  const Ray shadow_ray(
+      interaction.p, light_dir, RAY_DEFAULT_MIN, dist_to_light);
+  if (scene->occluded(shadow_ray)) {
     return color;  // Occluded
   }
 
@@ -204,6 +405,67 @@ Vec3f IntersectionTestIntegrator::directLighting(
   return color;
 }
 
+/* ===================================================================== *
+ *
+ * Traversal Heatmap Integrator's Implementation
+ *
+ * ===================================================================== */
+
+void TraversalHeatmapIntegrator::render(ref<Camera> camera, ref<Scene> scene) {
+  const Vec2i &resolution = camera->getFilm()->getResolution();
+
+  // Totals over all rays, to summarize the heatmap in the log
+  uint64_t total_node_visits = 0, total_primitive_tests = 0;
+  uint64_t max_node_visits = 0, max_primitive_tests = 0;
+  std::mutex totals_lock;
+
+  print("Rendering traversal heatmap with spp = {}\n", spp);
+  const auto render_column = [&](int dx, Sampler &sampler) {
+    sampler.setType(sampler_type, spp);
+    TraversalStats column_total, column_max;
+    for (int dy = 0; dy < resolution.y; dy++) {
+      sampler.setPixelIndex2D(Vec2i(dx, dy));
+      for (int sample = 0; sample < spp; sample++) {
+        sampler.startPixelSample(sample);
+        const Vec2f &pixel_sample = sampler.getPixelSample();
+        const DifferentialRay ray =
+            camera->generateDifferentialRay(pixel_sample.x, pixel_sample.y);
+
+        TraversalStats stats;
+        {
+          const TraversalStatsScope scope(stats);
+          SurfaceInteraction interaction;
+          scene->intersect(ray, interaction);
+        }
+
+        column_total.node_visits     += stats.node_visits;
+        column_total.primitive_tests += stats.primitive_tests;
+        column_max.node_visits =
+            std::max(column_max.node_visits, stats.node_visits);
+        column_max.primitive_tests =
+            std::max(column_max.primitive_tests, stats.primitive_tests);
+        camera->getFilm()->commitSample(pixel_sample,
+            Vec3f(static_cast<Float>(stats.node_visits),
+                static_cast<Float>(stats.primitive_tests), 0.0F));
+      }
+    }
+
+    std::scoped_lock<std::mutex> lock(totals_lock);
+    total_node_visits     += column_total.node_visits;
+    total_primitive_tests += column_total.primitive_tests;
+    max_node_visits = std::max(max_node_visits, column_max.node_visits);
+    max_primitive_tests =
+        std::max(max_primitive_tests, column_max.primitive_tests);
+  };
+  ParallelExecute<Sampler>(executor, 0, resolution.x, render_column);
+
+  const auto n_rays = static_cast<double>(resolution.x) * resolution.y * spp;
+  Info_("Node visits per ray: {:.2f} on average, {} at most",
+      total_node_visits / n_rays, max_node_visits);
+  Info_("Primitive tests per ray: {:.2f} on average, {} at most",
+      total_primitive_tests / n_rays, max_primitive_tests);
+}
+
 /* ===================================================================== *
  *
  * Path Integrator's Implementation
@@ -20,6 +20,10 @@ static void printHelp(int, char *argv[]) {  // NOLINT
       << format("  --help,-h             Print this help text.\n")
       << format("  --quite,-q            Not output during rendering.\n")
       << format("  --output,-o <path>    Override the default output path.\n")
+      << format(
+             "  --resume <path>       Save a checkpoint to the path after "
+             "every progressive pass,\n"
+             "                        and continue from it if it exists.\n")
       << format(
              "  --override  <json>    Override the scene specification with a "
              "single-line json,\n"
@@ -34,6 +38,7 @@ int rdr_main(int argc, char *argv[]) {  // NOLINT: alias of main function
   fs::path source_path{};
   std::optional<std::string> output_path{};
   std::optional<std::string> override_json_string{};
+  std::optional<fs::path> checkpoint_path{};
 
   if (argc <= 1) {
     printHelp(argc, argv);
@@ -55,6 +60,15 @@ int rdr_main(int argc, char *argv[]) {  // NOLINT: alias of main function
         printHelp(argc, argv);
         return 1;
       }
+    } else if (arg == "--resume") {
+      if (i + 1 < argc) {
+        // Relative to the working directory rather than the scene
+        checkpoint_path = fs::absolute(argv[++i]);
+      } else {
+        print("Missing checkpoint path after [ {} ]\n", arg);
+        printHelp(argc, argv);
+        return 1;
+      }
     } else if (arg == "--override") {
       if (i + 1 < argc) {
         override_json_string = argv[++i];
@@ -115,6 +129,11 @@ int rdr_main(int argc, char *argv[]) {  // NOLINT: alias of main function
     if (override_json_string.has_value())
       root_json.update(
           nlohmann::json::parse(override_json_string.value()), true);
+    if (checkpoint_path.has_value()) {
+      root_json["integrator"]["checkpoint_path"] =
+          checkpoint_path.value().string();
+      root_json["integrator"]["resume"] = true;
+    }
     root_properties = Properties(root_json);
   } catch (nlohmann::json::exception &ex) {
     // print error message
@@ -33,31 +33,57 @@ void Primitive::crossConfiguration(const CrossConfigurationContext &context) {
 
 bool Primitive::intersect(Ray &ray, SurfaceInteraction &interaction) const {
   if (shape->intersect(ray, interaction)) {
-    if (bsdf) {
-      // primitive is responsible for setting these
-      if (bsdf->isDelta()) {
-        interaction.type = ESurfaceInteractionType::ESpecular;
-        // TODO
-      } else if (dynamic_cast<MicrofacetReflection *>(bsdf.get()) != nullptr) {
-        interaction.type = ESurfaceInteractionType::EGlossy;
-      } else {
-        interaction.type = ESurfaceInteractionType::EDiffuse;
-      }
-    }
+    setInteraction(ray, interaction);
+    return true;
+  }
 
-    // TODO: should it be set here
-    // not for bi-direction method
-    interaction.wo = -ray.direction;
+  return false;
+}
 
-    // set the type of interaction
-    // which is set to GEOMETRY if light is not presented
-    if (area_light) interaction.type = ESurfaceInteractionType::ELight;
-    interaction.setPrimitive(bsdf.get(), area_light.get(), this);
+bool Primitive::intersectHit(Ray &ray, HitRecord &hit) const {
+  return shape->intersectHit(ray, hit);
+}
 
-    return true;
+void Primitive::computeSurfaceInteraction(const Ray &ray, const HitRecord &hit,
+    SurfaceInteraction &interaction) const {
+  shape->computeSurfaceInteraction(ray, hit, interaction);
+  setInteraction(ray, interaction);
+}
+
+RayMask Primitive::intersectPacket(
+    Ray *rays, SurfaceInteraction *interactions, RayMask mask) const {
+  const RayMask result = shape->intersectPacket(rays, interactions, mask);
+  for (int i = 0; i < RAY_PACKET_SIZE; ++i)
+    if (IsRayActive(result, i)) setInteraction(rays[i], interactions[i]);
+  return result;
+}
+
+void Primitive::setInteraction(
+    const Ray &ray, SurfaceInteraction &interaction) const {
+  if (bsdf) {
+    // primitive is responsible for setting these
+    if (bsdf->isDelta()) {
+      interaction.type = ESurfaceInteractionType::ESpecular;
+      // TODO
+    } else if (dynamic_cast<MicrofacetReflection *>(bsdf.get()) != nullptr) {
+      interaction.type = ESurfaceInteractionType::EGlossy;
+    } else {
+      interaction.type = ESurfaceInteractionType::EDiffuse;
+    }
   }
 
-  return false;
+  // TODO: should it be set here
+  // not for bi-direction method
+  interaction.wo = -ray.direction;
+
+  // set the type of interaction
+  // which is set to GEOMETRY if light is not presented
+  if (area_light) interaction.type = ESurfaceInteractionType::ELight;
+  interaction.setPrimitive(bsdf.get(), area_light.get(), this);
+}
+
+bool Primitive::occluded(const Ray &ray) const {
+  return shape->occluded(ray);
 }
 
 AABB Primitive::getBound() const {
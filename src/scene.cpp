@@ -1,9 +1,11 @@
 #include "rdr/scene.h"
 
 #include "rdr/accel.h"
+#include "rdr/bvh_accel.h"
 #include "rdr/integrator.h"
 #include "rdr/light.h"
 #include "rdr/primitive.h"
+#include "rdr/shape.h"
 
 RDR_NAMESPACE_BEGIN
 
@@ -20,9 +22,26 @@ void Scene::crossConfiguration(const CrossConfigurationContext &context) {
 
   clearProperties();
 
+  // All shapes of the scene exist by now, the shared meshes are kept alive by
+  // the instances only and are released together with the scene
+  TriangleMesh::ClearSharedMeshes();
+
   // Still, a hack; make sure that scene bound is built prior to other
   // initialization
   primitive_tree.build();
+
+  instances.clear();
+  for (const auto &node : primitive_tree.getNodes()) {
+    detail_::SceneInstance instance;
+    instance.primitive = node.getData().get();
+    const Shape *shape = instance.primitive->getShape().get();
+    instance.mesh      = dynamic_cast<const TriangleMesh *>(shape);
+    if (instance.mesh != nullptr)
+      instance.accel =
+          dynamic_cast<const BVHAccel *>(instance.mesh->getAccel().get());
+    if (instance.accel == nullptr) instance.mesh = nullptr;
+    instances.push_back(instance);
+  }
 }
 
 void Scene::preprocess(const PreprocessContext &context) {
@@ -53,9 +72,134 @@ void Scene::addInfiniteLight(const ref<InfiniteAreaLight> &light) {
   addLight(light);
 }
 
+namespace {
+/// The top level of Scene::traverse, the rest of a leaf of the scene BVH
+constexpr int32_t TOP_LEVEL = -1;
+constexpr int32_t LEAF_SPAN = -2;
+
+struct StackEntry {
+  int32_t index;       ///<! node, or the next data node if LEAF_SPAN
+  int32_t instance;    ///<! TOP_LEVEL, LEAF_SPAN or the instance of the node
+  int32_t span_right;  ///<! the end of the data nodes if LEAF_SPAN
+};
+
+/// Slab test of the node. If an interior node is hit, push its children such
+/// that the near one is popped first, and return false. Return whether the
+/// node is a leaf which is hit.
+template <typename LinearNode>
+RDR_FORCEINLINE bool VisitNode(const LinearNode &node, const Ray &ray,
+    const bool dir_is_neg[3], const StackEntry &entry, StackEntry *stack,
+    int &stack_size) {
+  if (!node.intersect(ray)) return false;
+  if (node.isLeaf()) return true;
+
+  const StackEntry first{entry.index + 1, entry.instance, 0};
+  const StackEntry second{node.offset, entry.instance, 0};
+  const bool second_is_near = dir_is_neg[node.getAxis()];
+  stack[stack_size++]       = second_is_near ? first : second;
+  stack[stack_size++]       = second_is_near ? second : first;
+  return false;
+}
+}  // namespace
+
+template <bool AnyHit>
+bool Scene::traverse(
+    Ray &ray, HitRecord &hit, const Primitive **hit_primitive) const {
+  const auto &top_nodes = primitive_tree.getLinearNodes();
+  if (top_nodes.empty()) return false;
+
+  // Both levels are at most CUTOFF_DEPTH deep, and a single LEAF_SPAN entry
+  // is pending at a time
+  constexpr int STACK_SIZE = 2 * BVHAccel::TreeType::STACK_SIZE;
+  StackEntry stack[STACK_SIZE];
+  int stack_size      = 0;
+  stack[stack_size++] = {0, TOP_LEVEL, 0};
+
+  // The instance whose nodes were visited last, and the ray in its space
+  int32_t current = TOP_LEVEL;
+  Ray local_ray   = ray;
+  Float scale     = 1;
+  bool dir_is_neg[3];
+  const auto set_direction = [&](const Ray &active_ray) {
+    for (int axis = 0; axis < 3; ++axis)
+      dir_is_neg[axis] = active_ray.direction[axis] < 0;
+  };
+  set_direction(ray);
+
+  TraversalStats *stats = CurrentTraversalStats();
+  bool result           = false;
+  while (stack_size > 0) {
+    const StackEntry entry = stack[--stack_size];
+    if (entry.instance == LEAF_SPAN) {
+      // Hand over the data nodes of a leaf one by one, such that the
+      // instances never pile up on the stack
+      if (entry.index + 1 < entry.span_right)
+        stack[stack_size++] = {entry.index + 1, LEAF_SPAN, entry.span_right};
+
+      const auto &instance = instances[entry.index];
+      if (instance.accel != nullptr) {
+        stack[stack_size++] = {0, entry.index, 0};
+        continue;
+      }
+
+      if (stats != nullptr) ++stats->primitive_tests;
+      if constexpr (AnyHit) {
+        if (instance.primitive->occluded(ray)) return true;
+      } else if (instance.primitive->intersectHit(ray, hit)) {
+        *hit_primitive = instance.primitive;
+        result         = true;
+      }
+      continue;
+    }
+
+    // Entries of an instance are contiguous on the stack, so its ray is
+    // mapped once per instance, with the t_max found so far
+    if (entry.instance != current) {
+      current = entry.instance;
+      if (current != TOP_LEVEL)
+        local_ray = instances[current].mesh->rayToObject(ray, &scale);
+      set_direction(current == TOP_LEVEL ? ray : local_ray);
+    }
+
+    if (stats != nullptr) ++stats->node_visits;
+    if (current == TOP_LEVEL) {
+      const auto &node = top_nodes[entry.index];
+      if (VisitNode(node, ray, dir_is_neg, entry, stack, stack_size))
+        stack[stack_size++] = {
+            node.offset, LEAF_SPAN, node.offset + node.getCount()};
+      continue;
+    }
+
+    const auto &instance = instances[current];
+    const auto &node = instance.accel->getTree().getLinearNodes()[entry.index];
+    if (!VisitNode(node, local_ray, dir_is_neg, entry, stack, stack_size))
+      continue;
+
+    const int span_left = node.offset, span_right = span_left + node.getCount();
+    if (stats != nullptr) stats->primitive_tests += node.getCount();
+    if constexpr (AnyHit) {
+      if (instance.accel->occludedLeaf(local_ray, span_left, span_right))
+        return true;
+    } else if (instance.accel->intersectLeaf(
+                   local_ray, span_left, span_right, hit)) {
+      *hit_primitive = instance.primitive;
+      ray.setTimeMax(local_ray.t_max / scale);
+      result = true;
+    }
+  }
+
+  return result;
+}
+
+bool Scene::occluded(const Ray &ray) const {
+  Ray new_ray = ray;
+  HitRecord hit;
+  const Primitive *hit_primitive = nullptr;
+  return traverse<true>(new_ray, hit, &hit_primitive);
+}
+
 bool Scene::isBlocked(const Ray &shadow_ray) const {
-  SurfaceInteraction in;
-  return isBlocked(shadow_ray, in);
+  return occluded(shadow_ray);
 }
 
 bool Scene::isBlocked(
@@ -64,15 +208,124 @@ bool Scene::isBlocked(
 }
 
 bool Scene::intersect(const Ray &ray, SurfaceInteraction &interaction) const {
-  Ray new_ray      = ray;
-  bool intersected = primitive_tree.intersect(new_ray,
-      [&interaction](
-          Ray &internal_ray, const ref<Primitive> &primitive) -> bool {
-        // If it is requested, it must intersect with this bounding box
-        return primitive->intersect(internal_ray, interaction);
+  // Only the closest hit pays for its SurfaceInteraction
+  Ray new_ray = ray;
+  HitRecord hit;
+  const Primitive *hit_primitive = nullptr;
+  if (!traverse<false>(new_ray, hit, &hit_primitive)) return false;
+
+  hit_primitive->computeSurfaceInteraction(new_ray, hit, interaction);
+  assert(interaction.type != ESurfaceInteractionType::ENone);
+  return true;
+}
+
+RayMask Scene::intersectPacket(const Ray *rays,
+    SurfaceInteraction *interactions, RayMask mask) const {
+  Ray new_rays[RAY_PACKET_SIZE];
+  for (int i = 0; i < RAY_PACKET_SIZE; ++i)
+    if (IsRayActive(mask, i)) new_rays[i] = rays[i];
+
+  // As in intersect(), only the closest hit of each ray pays for its
+  // SurfaceInteraction
+  HitRecord hits[RAY_PACKET_SIZE];
+  const Primitive *hit_primitives[RAY_PACKET_SIZE] = {};
+  const RayMask hit_mask = primitive_tree.intersectPacketLeaves(new_rays, mask,
+      [&](Ray *internal_rays, RayMask active, int span_left,
+          int span_right) -> RayMask {
+        RayMask result = 0;
+        for (int i = span_left; i < span_right; ++i) {
+          const auto &instance  = instances[i];
+          RayMask instance_hits = 0;
+          if (instance.accel != nullptr) {
+            // An affine map keeps a coherent packet coherent in object space
+            Ray object_rays[RAY_PACKET_SIZE];
+            Float scales[RAY_PACKET_SIZE];
+            for (int j = 0; j < RAY_PACKET_SIZE; ++j)
+              if (IsRayActive(active, j))
+                object_rays[j] =
+                    instance.mesh->rayToObject(internal_rays[j], &scales[j]);
+
+            instance_hits = instance.accel->getTree().intersectPacketLeaves(
+                object_rays, active,
+                [&](Ray *local_rays, RayMask leaf_active, int leaf_left,
+                    int leaf_right) -> RayMask {
+                  RayMask leaf_hits = 0;
+                  for (int j = 0; j < RAY_PACKET_SIZE; ++j)
+                    if (IsRayActive(leaf_active, j) &&
+                        instance.accel->intersectLeaf(
+                            local_rays[j], leaf_left, leaf_right, hits[j]))
+                      leaf_hits |= RayMask(1) << j;
+                  return leaf_hits;
+                });
+            for (int j = 0; j < RAY_PACKET_SIZE; ++j)
+              if (IsRayActive(instance_hits, j))
+                internal_rays[j].setTimeMax(object_rays[j].t_max / scales[j]);
+          } else {
+            for (int j = 0; j < RAY_PACKET_SIZE; ++j)
+              if (IsRayActive(active, j) &&
+                  instance.primitive->intersectHit(internal_rays[j], hits[j]))
+                instance_hits |= RayMask(1) << j;
+          }
+
+          for (int j = 0; j < RAY_PACKET_SIZE; ++j)
+            if (IsRayActive(instance_hits, j))
+              hit_primitives[j] = instance.primitive;
+          result |= instance_hits;
+        }
+        return result;
       });
-  if (intersected) assert(interaction.type != ESurfaceInteractionType::ENone);
-  return intersected;
+
+  for (int i = 0; i < RAY_PACKET_SIZE; ++i)
+    if (IsRayActive(hit_mask, i))
+      hit_primitives[i]->computeSurfaceInteraction(
+          new_rays[i], hits[i], interactions[i]);
+  return hit_mask;
+}
+
+void Scene::intersectStream(const Ray *rays, SurfaceInteraction *interactions,
+    bool *hits, int n_rays) const {
+  // Counting sort of the rays by the octant of their directions
+  const auto get_octant = [](const Ray &ray) {
+    return (ray.direction.x < 0) | (ray.direction.y < 0) << 1 |
+           (ray.direction.z < 0) << 2;
+  };
+
+  int octant_offsets[9] = {};
+  for (int i = 0; i < n_rays; ++i) ++octant_offsets[get_octant(rays[i]) + 1];
+  for (int octant = 0; octant < 8; ++octant)
+    octant_offsets[octant + 1] += octant_offsets[octant];
+
+  vector<int> order(n_rays);
+  for (int i = 0; i < n_rays; ++i)
+    order[octant_offsets[get_octant(rays[i])]++] = i;
+
+  // Packets never mix octants, so they are cut at the octant boundaries,
+  // which are the offsets after the scatter above
+  int begin = 0;
+  for (int octant = 0; octant < 8; ++octant) {
+    const int end = octant_offsets[octant];
+    for (int first = begin; first < end; first += RAY_PACKET_SIZE) {
+      const int size = Min(RAY_PACKET_SIZE, end - first);
+
+      Ray packet_rays[RAY_PACKET_SIZE];
+      SurfaceInteraction packet_interactions[RAY_PACKET_SIZE];
+      for (int i = 0; i < size; ++i) {
+        packet_rays[i]         = rays[order[first + i]];
+        packet_interactions[i] = interactions[order[first + i]];
+      }
+
+      const RayMask mask   = (RayMask(1) << size) - 1;
+      const RayMask result =
+          intersectPacket(packet_rays, packet_interactions, mask);
+      for (int i = 0; i < size; ++i) {
+        hits[order[first + i]] = IsRayActive(result, i);
+        if (IsRayActive(result, i))
+          interactions[order[first + i]] = packet_interactions[i];
+      }
+    }
+
+    begin = end;
+  }
 }
 
 Float Scene::pdfEmitterDirect(const SurfaceInteraction &interaction) const {
@@ -2,9 +2,13 @@
 
 #include <math.h>
 
+#include <map>
+#include <mutex>
+
 #include "linalg.h"
 #include "rdr/accel.h"
 #include "rdr/bvh_accel.h"
+#include "rdr/bvh_cache.h"
 #include "rdr/canary.h"
 #include "rdr/interaction.h"
 #include "rdr/load_obj.h"
@@ -12,19 +16,36 @@
 
 RDR_NAMESPACE_BEGIN
 
+bool Shape::intersect(Ray &ray, SurfaceInteraction &interaction) const {
+  HitRecord hit;
+  if (!intersectHit(ray, hit)) return false;
+
+  computeSurfaceInteraction(ray, hit, interaction);
+  return true;
+}
+
+RayMask Shape::intersectPacket(
+    Ray *rays, SurfaceInteraction *interactions, RayMask mask) const {
+  RayMask result = 0;
+  for (int i = 0; i < RAY_PACKET_SIZE; ++i)
+    if (IsRayActive(mask, i) && intersect(rays[i], interactions[i]))
+      result |= RayMask(1) << i;
+  return result;
+}
+
 Sphere::Sphere(const Properties &props)
     : Shape(props),
       center(props.getProperty<Vec3f>("center", Vec3f(0, 0, 0))),
       radius(props.getProperty<Float>("radius", 1)) {}
 
-bool Sphere::intersect(Ray &ray, SurfaceInteraction &interaction) const {
+bool Sphere::intersectDistance(const Ray &ray, Double *t) const {
   using InternalScalarType = Double;
   using InternalVecType    = Vec<InternalScalarType, 3>;
   const InternalVecType &o = Cast<InternalScalarType>(ray.origin);
   const InternalVecType &d = Normalize(Cast<InternalScalarType>(ray.direction));
   const InternalVecType &p = Cast<InternalScalarType>(center);
 
-  InternalScalarType t, t1, t2;
+  InternalScalarType t1, t2;
   {  // quadratic
     /* Ray intersect with sphere
     ** ||o + td - p||_2^2 = r^2
@@ -53,12 +74,32 @@ bool Sphere::intersect(Ray &ray, SurfaceInteraction &interaction) const {
 
   assert(t1 <= t2);
   if (ray.withinTimeRange(t1) || ray.withinTimeRange(t2)) {
-    t = ray.withinTimeRange(t1) ? t1 : t2;
-  } else {
-    return false;
+    *t = ray.withinTimeRange(t1) ? t1 : t2;
+    return true;
   }
 
-  InternalVecType position = o + t * d;
+  return false;
+}
+
+bool Sphere::intersectHit(Ray &ray, HitRecord &hit) const {
+  Double t;
+  if (!intersectDistance(ray, &t)) return false;
+
+  ray.setTimeMax(t);
+  return true;
+}
+
+void Sphere::computeSurfaceInteraction(const Ray &ray, const HitRecord &hit,
+    SurfaceInteraction &interaction) const {
+  using InternalScalarType = Double;
+  using InternalVecType    = Vec<InternalScalarType, 3>;
+  const InternalVecType &o = Cast<InternalScalarType>(ray.origin);
+  const InternalVecType &d = Normalize(Cast<InternalScalarType>(ray.direction));
+  const InternalVecType &p = Cast<InternalScalarType>(center);
+
+  // The hit is where the time range of the ray ends, and is refined below
+  const InternalScalarType t = ray.t_max;
+  InternalVecType position   = o + t * d;
 
   InternalVecType delta_p = position - p;
 
@@ -153,9 +194,11 @@ bool Sphere::intersect(Ray &ray, SurfaceInteraction &interaction) const {
       Cast<Float>(Normalize(delta_p)),
       {static_cast<Float>(v), static_cast<Float>(u)}, Cast<Float>(dpdv),
       Cast<Float>(dpdu), Cast<Float>(dndv), Cast<Float>(dndu));
+}
 
-  ray.setTimeMax(t);
-  return true;
+bool Sphere::occluded(const Ray &ray) const {
+  Double t;
+  return intersectDistance(ray, &t);
 }
 
 Float Sphere::area() const {
@@ -181,13 +224,145 @@ Float Sphere::pdf(const SurfaceInteraction &interaction) const {
   return 1.0 / area();
 }
 
-TriangleMesh::TriangleMesh(const Properties &props)
-    : Shape(props), mesh(make_ref<TriangleMeshResource>()) {
+namespace {
+/// The object-space mesh and accel shared by all instances of a file
+struct SharedMesh {
+  ref<TriangleMeshResource> mesh;
+  ref<Accel> accel;
+};
+
+std::mutex shared_meshes_mutex;
+std::map<std::string, SharedMesh> shared_meshes;
+}  // namespace
+
+void TriangleMesh::ClearSharedMeshes() {
+  std::lock_guard<std::mutex> lock(shared_meshes_mutex);
+  shared_meshes.clear();
+}
+
+TriangleMesh::TriangleMesh(const Properties &props) : Shape(props) {
   auto path = props.getProperty<std::string>("path");
   path      = FileResolver::resolveToAbs(path);
 
   const auto transform = props.getProperty<Mat4f>("transform", IdentityMatrix4);
   const auto translate = props.getProperty<Vec3f>("translate", Vec3f(0.0));
+
+  // The optional "accel" block selects and tunes the acceleration structure
+  const bool has_accel_props = props.hasProperty("accel");
+  const auto accel_props =
+      has_accel_props ? props.getProperty<Properties>("accel") : Properties();
+
+  const bool is_affine = transform[0][3] == 0 && transform[1][3] == 0 &&
+                         transform[2][3] == 0 && transform[3][3] == 1;
+  const bool instanced = props.getProperty<bool>("instanced", false);
+  if (instanced && !is_affine)
+    Warn_("Projective transform of [ {} ] is baked instead of instanced", path);
+
+  if (instanced && is_affine) {
+    to_world = transform;
+    to_world[3] += Vec4f(translate, 0);
+    to_object = Inverse(to_world);
+    for (int i = 0; i < 4; ++i)
+      has_transform |= to_world[i] != IdentityMatrix4[i];
+
+    const Mat3f linear{
+        to_world[0].xyz(), to_world[1].xyz(), to_world[2].xyz()};
+    normal_to_world = Transpose(Inverse(linear));
+
+    // Instances of the same file share everything built in object space
+    const std::string key =
+        path + '\n' + (has_accel_props ? accel_props.toString() : "");
+    std::lock_guard<std::mutex> lock(shared_meshes_mutex);
+    auto shared = shared_meshes.find(key);
+    if (shared == shared_meshes.end()) {
+      loadAccel(path, IdentityMatrix4, Vec3f(0.0), accel_props,
+          has_accel_props);
+      shared = shared_meshes.emplace(key, SharedMesh{mesh, accel}).first;
+    } else {
+      Info_("Instancing model {}", path);
+    }
+
+    mesh  = shared->second.mesh;
+    accel = shared->second.accel;
+  } else {
+    loadAccel(path, transform, translate, accel_props, has_accel_props);
+  }
+
+  // The bound of the instance encloses the transformed corners of the bound of
+  // the shared accel
+  const AABB object_bound = accel->getBound();
+  for (int i = 0; i < 8; ++i) {
+    const Vec3f corner((i & 1) ? object_bound.upper_bnd.x
+                               : object_bound.low_bnd.x,
+        (i & 2) ? object_bound.upper_bnd.y : object_bound.low_bnd.y,
+        (i & 4) ? object_bound.upper_bnd.z : object_bound.low_bnd.z);
+    world_bound.unionWith(pointToWorld(corner));
+  }
+
+  // Calculate the world-space area of each triangle. The sum is kept serial
+  // such that the total area does not depend on the number of threads.
+  int n_triangles = mesh->v_indices.size() / 3;
+  areas.resize(n_triangles);
+#pragma omp parallel for schedule(static)
+  for (int i = 0; i < n_triangles; ++i) {
+    Vec3f v0 = pointToWorld(mesh->getVertex(i * 3));
+    Vec3f v1 = pointToWorld(mesh->getVertex(i * 3 + 1));
+    Vec3f v2 = pointToWorld(mesh->getVertex(i * 3 + 2));
+    areas[i] = 0.5f * Norm(Cross(v1 - v0, v2 - v0));
+    AssertAllPositive(areas[i]);
+  }
+  for (int i = 0; i < n_triangles; ++i) total_area += areas[i];
+
+  // Initialize the distribution.
+  dist = make_ref<Distribution1D>(areas.data(), n_triangles);
+}
+
+void TriangleMesh::loadAccel(const std::string &path, const Mat4f &transform,
+    const Vec3f &translate, const Properties &accel_props,
+    bool has_accel_props) {
+  mesh = make_ref<TriangleMeshResource>();
+  if (has_accel_props) {
+    accel = CreateAccel(accel_props);
+  } else {
+#ifdef USE_EMBREE
+    accel = make_ref<ExternalBVHAccel>();
+#else
+    accel = make_ref<BVHAccel>();
+#endif
+  }
+
+  // With "cache": true in the "accel" block, the processed mesh and the built
+  // accel are restored from "cache_dir" if nothing they depend on changed
+  optional<BVHCache> cache;
+  if (has_accel_props && accel_props.getProperty<bool>("cache", false)) {
+    const std::string accel_desc = accel_props.toString();
+    uint64_t key                 = HashFile(path);
+    key = HashBytes(&transform, sizeof(transform), key);
+    key = HashBytes(&translate, sizeof(translate), key);
+    key = HashBytes(accel_desc.data(), accel_desc.size(), key);
+    cache.emplace(accel_props.getProperty<std::string>("cache_dir",
+                      BVHCache::GetDefaultDirectory().string()),
+        key);
+  }
+
+  if (!cache.has_value() || !cache->load(mesh, *accel)) {
+    loadMesh(path, transform, translate);
+    accel->setTriangleMesh(mesh.get());
+    accel->build();
+    if (cache.has_value()) cache->save(*mesh, *accel);
+  }
+
+  const size_t n_triangles = mesh->v_indices.size() / 3;
+  const size_t accel_bytes = accel->getMemoryUsage();
+  if (accel_bytes != 0)
+    Info_("Accel of [ {} ] takes {:.1f} bytes per triangle", path,
+        static_cast<double>(accel_bytes) / n_triangles);
+  if (has_accel_props && accel_props.getProperty<bool>("stats", false))
+    Info_("Accel of [ {} ]: {}", path, accel->getStatistics());
+}
+
+void TriangleMesh::loadMesh(const std::string &path, const Mat4f &transform,
+    const Vec3f &translate) {
   const auto normal_transform = Transpose(Inverse(transform));
 
   LoadObj(path, mesh->vertices, mesh->normals, mesh->texture_coordinates,
@@ -207,26 +382,6 @@ TriangleMesh::TriangleMesh(const Properties &props)
   mesh->has_normal  = !mesh->normals.empty();
   mesh->has_texture = !mesh->texture_coordinates.empty();
 
-#ifdef USE_EMBREE
-  accel = make_ref<ExternalBVHAccel>();
-#else
-  accel = make_ref<BVHAccel>();
-#endif
-
-  accel->setTriangleMesh(mesh.get());
-  accel->build();
-
-  // Calculate the area of each triangle.
-  int n_triangles = mesh->v_indices.size() / 3;
-  for (int i = 0; i < n_triangles; ++i) {
-    Vec3f v0 = mesh->getVertex(i * 3);
-    Vec3f v1 = mesh->getVertex(i * 3 + 1);
-    Vec3f v2 = mesh->getVertex(i * 3 + 2);
-    areas.push_back(0.5f * Norm(Cross(v1 - v0, v2 - v0)));
-    AssertAllPositive(areas.back());
-    total_area += areas.back();
-  }
-
   // Reorder vertices to ensure correct normal interpolation
   if (mesh->has_normal) {
     // When the shading normal and calculated face normal is not matched, flip
@@ -239,8 +394,11 @@ TriangleMesh::TriangleMesh(const Properties &props)
       return Normalize(Cross(v1 - v0, v2 - v0));
     };
 
-    // Normals might be inconsistent
-    for (std::size_t i = 0; i < n_triangles; ++i) {
+    // Normals might be inconsistent. Each triangle only touches its own
+    // indices, so they are fixed independently.
+    const int n_triangles = mesh->v_indices.size() / 3;
+#pragma omp parallel for schedule(static)
+    for (int i = 0; i < n_triangles; ++i) {
       if (Dot(obtain_face_normal(i), mesh->normals[mesh->n_indices[i * 3]]) <
           0) {
         std::swap(mesh->v_indices[i * 3 + 1], mesh->v_indices[i * 3 + 2]);
@@ -248,14 +406,83 @@ TriangleMesh::TriangleMesh(const Properties &props)
       }
     }
   }
+}
 
-  // Initialize the distribution.
-  dist = make_ref<Distribution1D>(areas.data(), n_triangles);
+Ray TriangleMesh::rayToObject(const Ray &ray, Float *scale) const {
+  if (!has_transform) {
+    *scale = 1;
+    return ray;
+  }
+
+  const Vec3f origin    = Mul(to_object, Vec4f(ray.origin, 1)).xyz();
+  const Vec3f direction = Mul(to_object, Vec4f(ray.direction, 0)).xyz();
+  *scale                = Norm(direction);
+  return {origin, direction / *scale, ray.t_min * *scale,
+      ray.t_max * *scale};
+}
+
+bool TriangleMesh::intersectHit(Ray &ray, HitRecord &hit) const {
+  if (!has_transform) return accel->intersectHit(ray, hit);
+
+  Float scale;
+  Ray object_ray = rayToObject(ray, &scale);
+  if (!accel->intersectHit(object_ray, hit)) return false;
+  ray.setTimeMax(object_ray.t_max / scale);
+  return true;
 }
 
-bool TriangleMesh::intersect(Ray &ray, SurfaceInteraction &interaction) const {
-  bool intersect = accel->intersect(ray, interaction);
-  return intersect;
+void TriangleMesh::computeSurfaceInteraction(const Ray &ray,
+    const HitRecord &hit, SurfaceInteraction &interaction) const {
+  // The barycentric coordinates do not depend on the space
+  accel->computeSurfaceInteraction(hit, interaction);
+  if (has_transform) interactionToWorld(interaction);
+}
+
+bool TriangleMesh::occluded(const Ray &ray) const {
+  if (!has_transform) return accel->occluded(ray);
+
+  Float scale;
+  return accel->occluded(rayToObject(ray, &scale));
+}
+
+RayMask TriangleMesh::intersectPacket(
+    Ray *rays, SurfaceInteraction *interactions, RayMask mask) const {
+  if (!has_transform) return accel->intersectPacket(rays, interactions, mask);
+
+  // An affine map keeps a coherent packet coherent in object space
+  Ray object_rays[RAY_PACKET_SIZE];
+  Float scales[RAY_PACKET_SIZE];
+  for (int i = 0; i < RAY_PACKET_SIZE; ++i)
+    if (IsRayActive(mask, i))
+      object_rays[i] = rayToObject(rays[i], &scales[i]);
+
+  const RayMask result =
+      accel->intersectPacket(object_rays, interactions, mask);
+  for (int i = 0; i < RAY_PACKET_SIZE; ++i) {
+    if (!IsRayActive(result, i)) continue;
+    rays[i].setTimeMax(object_rays[i].t_max / scales[i]);
+    interactionToWorld(interactions[i]);
+  }
+
+  return result;
+}
+
+void TriangleMesh::interactionToWorld(SurfaceInteraction &interaction) const {
+  const auto to_world_vector = [&](const Vec3f &v) {
+    return Mul(to_world, Vec4f(v, 0)).xyz();
+  };
+  const auto to_world_normal = [&](const Vec3f &n) {
+    return Mul(normal_to_world, n);
+  };
+
+  const auto shading = interaction.shading;
+  interaction.setDifferential(pointToWorld(interaction.p),
+      Normalize(to_world_normal(interaction.normal)), interaction.uv,
+      to_world_vector(interaction.dpdu), to_world_vector(interaction.dpdv),
+      to_world_normal(interaction.dndu), to_world_normal(interaction.dndv));
+  interaction.setShading(Normalize(to_world_normal(shading.n)),
+      to_world_vector(shading.dpdu), to_world_vector(shading.dpdv),
+      to_world_normal(shading.dndu), to_world_normal(shading.dndv));
 }
 
 Float TriangleMesh::area() const {
@@ -267,9 +494,17 @@ SurfaceInteraction TriangleMesh::sample(Sampler &sampler) const {
   size_t triangle_index = dist->sampleDiscrete(sampler.get1D(), &dist_pdf);
   assert(triangle_index < areas.size());
 
-  Vec3f v0 = mesh->getVertex(triangle_index * 3);
-  Vec3f v1 = mesh->getVertex(triangle_index * 3 + 1);
-  Vec3f v2 = mesh->getVertex(triangle_index * 3 + 2);
+  const Vec3f p0 = mesh->getVertex(triangle_index * 3);
+  const Vec3f p1 = mesh->getVertex(triangle_index * 3 + 1);
+  const Vec3f p2 = mesh->getVertex(triangle_index * 3 + 2);
+  Vec3f v0       = pointToWorld(p0);
+  Vec3f v1       = pointToWorld(p1);
+  Vec3f v2       = pointToWorld(p2);
+
+  // The normal is mapped as in interactionToWorld, the world-space cross
+  // product would flip it under mirroring transforms
+  Vec3f normal = Cross(p1 - p0, p2 - p0);
+  if (has_transform) normal = Mul(normal_to_world, normal);
 
   // Sample a point on the triangle.
   // ha, https://pharr.org/matt/blog/2019/02/27/triangle-sampling-1
@@ -280,14 +515,14 @@ SurfaceInteraction TriangleMesh::sample(Sampler &sampler) const {
   SurfaceInteraction interaction;
   interaction.setGeneral(
       barycentric.x * v0 + barycentric.y * v1 + barycentric.z * v2,
-      Normalize(Cross(v1 - v0, v2 - v0)));
+      Normalize(normal));
   interaction.setPdf(dist_pdf / areas[triangle_index], EMeasure::EArea);
 
   return interaction;
 }
 
 AABB TriangleMesh::getBound() const {
-  return accel->getBound();
+  return world_bound;
 }
 
 Float TriangleMesh::pdf(const SurfaceInteraction &) const {
@@ -0,0 +1,371 @@
+#include "rdr/bvh_accel.h"
+#include "rdr/shape.h"
+
+RDR_NAMESPACE_BEGIN
+
+namespace {
+/// A (possibly clipped) part of a triangle, which might appear in many leaves
+struct Reference {
+  AABB bound;
+  uint32_t triangle_index;
+};
+
+/// The overlapping part of two boxes, empty if they are disjoint
+AABB IntersectBound(const AABB &a, const AABB &b) {
+  return {Max(a.low_bnd, b.low_bnd), Min(a.upper_bnd, b.upper_bnd)};
+}
+
+/**
+ * @brief The SBVH builder (Stich et al. 2009). Each node evaluates binned SAH
+ * object splits and, if the children of the best one overlap noticeably,
+ * binned spatial splits, which clip the references straddling the plane
+ * instead of assigning them to one side. The result is directly emitted as
+ * the depth-first linear nodes of BVHTree.
+ */
+class SpatialSplitBuilder {
+public:
+  using TreeType   = BVHTree<detail_::BVHTriangleNode>;
+  using LinearNode = TreeType::LinearNode;
+
+  // Spatial splits are only tried if the children of the best object split
+  // overlap more than this fraction of the root's surface area
+  constexpr static Float OVERLAP_THRESHOLD = 1e-5F;
+
+  SpatialSplitBuilder(const TriangleMeshResource &mesh,
+      const BVHBuildSettings &settings, size_t max_references)
+      : mesh(mesh), settings(settings), max_references(max_references) {}
+
+  void build(vector<Reference> references) {
+    n_references = references.size();
+    for (const auto &reference : references)
+      root_bound.unionWith(reference.bound);
+    root_area = root_bound.getSurfaceArea();
+    if (!references.empty()) buildNode(std::move(references), 0);
+  }
+
+  vector<uint32_t> triangle_order;  //<! triangle of each data node
+  vector<LinearNode> linear_nodes;  //<! in depth-first order
+
+private:
+  struct Split {
+    Float cost{Float_INF};
+    int dim{-1};
+    int bin{-1};  // the split is after this bin
+  };
+
+  struct Bin {
+    AABB bound{};
+    int count{0};  // object: references, spatial: references entering
+    int exits{0};  // spatial: references leaving
+  };
+
+  const TriangleMeshResource &mesh;
+  const BVHBuildSettings &settings;
+  const size_t max_references;
+
+  size_t n_references{0};
+  AABB root_bound{};
+  Float root_area{0};
+
+  int toBin(Float x, Float low, Float extent) const {
+    const int bin = static_cast<int>(settings.sah_bins * (x - low) / extent);
+    return std::clamp(bin, 0, settings.sah_bins - 1);
+  }
+
+  Float getSplitCost(Float area, int n_left, const AABB &left, int n_right,
+      const AABB &right) const {
+    return settings.traversal_cost +
+           settings.intersection_cost *
+               (n_left * left.getSurfaceArea() +
+                   n_right * right.getSurfaceArea()) /
+               area;
+  }
+
+  /// Clip the reference at the plane x[dim] = position
+  void splitReference(const Reference &reference, int dim, Float position,
+      Reference *left, Reference *right) const {
+    AABB left_bound, right_bound;
+    const uint32_t index = reference.triangle_index;
+    for (int i = 0; i < 3; ++i) {
+      const Vec3f v0 = mesh.getVertex(index * 3 + i);
+      const Vec3f v1 = mesh.getVertex(index * 3 + (i + 1) % 3);
+      if (v0[dim] <= position) left_bound.unionWith(v0);
+      if (v0[dim] >= position) right_bound.unionWith(v0);
+
+      // The edge crosses the plane
+      if ((v0[dim] < position && position < v1[dim]) ||
+          (v1[dim] < position && position < v0[dim])) {
+        const Float t = (position - v0[dim]) / (v1[dim] - v0[dim]);
+        Vec3f hit     = v0 + (v1 - v0) * t;
+        hit[dim]      = position;
+        left_bound.unionWith(hit);
+        right_bound.unionWith(hit);
+      }
+    }
+
+    left_bound.upper_bnd[dim] = position;
+    right_bound.low_bnd[dim]  = position;
+    *left  = {IntersectBound(left_bound, reference.bound), index};
+    *right = {IntersectBound(right_bound, reference.bound), index};
+  }
+
+  Split findObjectSplit(const vector<Reference> &references,
+      const AABB &bound, const AABB &centroid_bound) const {
+    Split best;
+    const int n_bins = settings.sah_bins;
+    const Float area = bound.getSurfaceArea();
+    for (int dim = 0; dim < 3; ++dim) {
+      const Float low    = centroid_bound.low_bnd[dim];
+      const Float extent = centroid_bound.getDist(dim);
+      if (!(extent > 0)) continue;
+
+      vector<Bin> bins(n_bins);
+      for (const auto &reference : references) {
+        auto &bin =
+            bins[toBin(reference.bound.getCenter()[dim], low, extent)];
+        bin.bound.unionWith(reference.bound);
+        ++bin.count;
+      }
+
+      vector<AABB> right_bounds(n_bins);
+      for (int i = n_bins - 1; i > 0; --i) {
+        right_bounds[i - 1] = right_bounds[i];
+        right_bounds[i - 1].unionWith(bins[i].bound);
+      }
+
+      AABB left_bound;
+      int n_left = 0;
+      for (int i = 0; i < n_bins - 1; ++i) {
+        left_bound.unionWith(bins[i].bound);
+        n_left += bins[i].count;
+        const int n_right = references.size() - n_left;
+        if (n_left == 0 || n_right == 0) continue;
+
+        const Float cost =
+            getSplitCost(area, n_left, left_bound, n_right, right_bounds[i]);
+        if (cost < best.cost) best = {cost, dim, i};
+      }
+    }
+
+    return best;
+  }
+
+  /// The first and the last spatial bins the reference overlaps
+  std::pair<int, int> getBinRange(const Reference &reference, int dim,
+      const AABB &bound) const {
+    const Float low    = bound.low_bnd[dim];
+    const Float extent = bound.getDist(dim);
+    const int first    = toBin(reference.bound.low_bnd[dim], low, extent);
+    const int last     = toBin(reference.bound.upper_bnd[dim], low, extent);
+    return {first, std::max(first, last)};
+  }
+
+  Float getPlane(int dim, int bin, const AABB &bound) const {
+    return bound.low_bnd[dim] +
+           bound.getDist(dim) * static_cast<Float>(bin + 1) / settings.sah_bins;
+  }
+
+  Split findSpatialSplit(
+      const vector<Reference> &references, const AABB &bound) const {
+    Split best;
+    const int n_bins = settings.sah_bins;
+    const Float area = bound.getSurfaceArea();
+    for (int dim = 0; dim < 3; ++dim) {
+      if (!(bound.getDist(dim) > 0)) continue;
+
+      // Chop every reference into the bins it overlaps
+      vector<Bin> bins(n_bins);
+      for (const auto &reference : references) {
+        const auto [first, last] = getBinRange(reference, dim, bound);
+        Reference rest           = reference;
+        for (int i = first; i < last; ++i) {
+          Reference left, right;
+          splitReference(rest, dim, getPlane(dim, i, bound), &left, &right);
+          bins[i].bound.unionWith(left.bound);
+          rest = right;
+        }
+
+        bins[last].bound.unionWith(rest.bound);
+        ++bins[first].count;
+        ++bins[last].exits;
+      }
+
+      vector<AABB> right_bounds(n_bins);
+      vector<int> right_counts(n_bins, 0);
+      for (int i = n_bins - 1; i > 0; --i) {
+        right_bounds[i - 1] = right_bounds[i];
+        right_bounds[i - 1].unionWith(bins[i].bound);
+        right_counts[i - 1] = right_counts[i] + bins[i].exits;
+      }
+
+      AABB left_bound;
+      int n_left = 0;
+      for (int i = 0; i < n_bins - 1; ++i) {
+        left_bound.unionWith(bins[i].bound);
+        n_left += bins[i].count;
+        const int n_right = right_counts[i];
+        if (n_left == 0 || n_right == 0) continue;
+
+        // Every duplicated reference consumes the budget
+        const size_t n_duplicates = n_left + n_right - references.size();
+        if (n_references + n_duplicates > max_references) continue;
+
+        const Float cost =
+            getSplitCost(area, n_left, left_bound, n_right, right_bounds[i]);
+        if (cost < best.cost) best = {cost, dim, i};
+      }
+    }
+
+    return best;
+  }
+
+  /// Emit the subtree of the references, return its linear node index
+  int buildNode(vector<Reference> references, int depth) {
+    AABB bound, centroid_bound;
+    for (const auto &reference : references) {
+      bound.unionWith(reference.bound);
+      centroid_bound.unionWith(reference.bound.getCenter());
+    }
+
+    const int count = references.size();
+    if (depth >= TreeType::CUTOFF_DEPTH || count <= 1)
+      return emitLeaf(references, bound);
+
+    const Split object_split =
+        findObjectSplit(references, bound, centroid_bound);
+
+    // Only pay for spatial binning if the object split leaves much overlap,
+    // or there is no object split at all, e.g. all centroids coincide
+    Split spatial_split;
+    bool try_spatial_split = object_split.dim < 0;
+    if (object_split.dim >= 0) {
+      AABB left_bound, right_bound;
+      const Float low    = centroid_bound.low_bnd[object_split.dim];
+      const Float extent = centroid_bound.getDist(object_split.dim);
+      for (const auto &reference : references) {
+        const Float centroid = reference.bound.getCenter()[object_split.dim];
+        auto &child = toBin(centroid, low, extent) <= object_split.bin
+                        ? left_bound
+                        : right_bound;
+        child.unionWith(reference.bound);
+      }
+
+      const Float overlap =
+          IntersectBound(left_bound, right_bound).getSurfaceArea();
+      try_spatial_split = overlap > OVERLAP_THRESHOLD * root_area;
+    }
+    if (try_spatial_split && n_references < max_references)
+      spatial_split = findSpatialSplit(references, bound);
+
+    const Float leaf_cost = settings.intersection_cost * count;
+    const Float best_cost = std::min(object_split.cost, spatial_split.cost);
+    if (count <= settings.max_leaf_size && leaf_cost <= best_cost)
+      return emitLeaf(references, bound);
+
+    vector<Reference> left, right;
+    int dim                = ArgMax(bound.getExtent());
+    bool use_spatial_split = spatial_split.cost < object_split.cost;
+    if (use_spatial_split) {
+      dim                  = spatial_split.dim;
+      const Float position = getPlane(dim, spatial_split.bin, bound);
+      for (const auto &reference : references) {
+        const auto [first, last] = getBinRange(reference, dim, bound);
+        if (last <= spatial_split.bin) {
+          left.push_back(reference);
+        } else if (first > spatial_split.bin) {
+          right.push_back(reference);
+        } else {
+          // The box might straddle the plane while the triangle does not
+          Reference left_part, right_part;
+          splitReference(reference, dim, position, &left_part, &right_part);
+          const bool has_left  = left_part.bound.isValid();
+          const bool has_right = right_part.bound.isValid();
+          if (has_left) left.push_back(left_part);
+          if (has_right) right.push_back(right_part);
+          if (has_left && has_right) ++n_references;
+          if (!has_left && !has_right) left.push_back(reference);
+        }
+      }
+
+      // Clipping might move every straddling reference to one side, which
+      // would emit an empty leaf. No reference was duplicated in that case.
+      if (left.empty() || right.empty()) {
+        left.clear();
+        right.clear();
+        use_spatial_split = false;
+      }
+    }
+
+    if (!use_spatial_split && object_split.dim >= 0) {
+      dim                = object_split.dim;
+      const Float low    = centroid_bound.low_bnd[dim];
+      const Float extent = centroid_bound.getDist(dim);
+      for (const auto &reference : references) {
+        const Float centroid = reference.bound.getCenter()[dim];
+        (toBin(centroid, low, extent) <= object_split.bin ? left : right)
+            .push_back(reference);
+      }
+    } else if (!use_spatial_split) {
+      // Coincident centroids and no usable clip, simply halve the span
+      left.assign(references.begin(), references.begin() + count / 2);
+      right.assign(references.begin() + count / 2, references.end());
+    }
+
+    references.clear();
+    references.shrink_to_fit();
+
+    const int node_index = linear_nodes.size();
+    linear_nodes.emplace_back();
+    buildNode(std::move(left), depth + 1);
+    const int right_index = buildNode(std::move(right), depth + 1);
+
+    auto &node     = linear_nodes[node_index];
+    node.low_bnd   = bound.low_bnd;
+    node.upper_bnd = bound.upper_bnd;
+    node.offset    = right_index;
+    node.packed    = static_cast<uint32_t>(dim);
+    return node_index;
+  }
+
+  int emitLeaf(const vector<Reference> &references, const AABB &bound) {
+    LinearNode node;
+    node.low_bnd   = bound.low_bnd;
+    node.upper_bnd = bound.upper_bnd;
+    node.offset    = triangle_order.size();
+    node.packed    = static_cast<uint32_t>(references.size()) << 2;
+    for (const auto &reference : references)
+      triangle_order.push_back(reference.triangle_index);
+
+    linear_nodes.push_back(node);
+    return linear_nodes.size() - 1;
+  }
+};
+}  // namespace
+
+void detail_::BuildSpatialSplitBVH(BVHTree<BVHTriangleNode> &tree,
+    const ref<TriangleMeshResource> &mesh) {
+  const auto &settings     = tree.getBuildSettings();
+  const size_t n_triangles = mesh->v_indices.size() / 3;
+  const auto max_references =
+      static_cast<size_t>(n_triangles * (1 + settings.spatial_split_budget));
+
+  vector<Reference> references(n_triangles);
+  for (uint32_t i = 0; i < n_triangles; ++i)
+    references[i] = {
+        AABB(mesh->getVertex(i * 3), mesh->getVertex(i * 3 + 1),
+            mesh->getVertex(i * 3 + 2)),
+        i};
+
+  SpatialSplitBuilder builder(*mesh, settings, max_references);
+  builder.build(std::move(references));
+
+  vector<BVHTriangleNode> nodes;
+  nodes.reserve(builder.triangle_order.size());
+  for (const auto &index : builder.triangle_order)
+    nodes.emplace_back(Triangle(index, mesh));
+
+  if (!tree.restore(std::move(nodes), std::move(builder.linear_nodes)))
+    Exception_("SBVH builder emitted an invalid tree");
+}
+
+RDR_NAMESPACE_END
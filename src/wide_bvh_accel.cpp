@@ -0,0 +1,505 @@
+#include "rdr/wide_bvh_accel.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <utility>
+
+#if defined(__SSE2__) || defined(_M_X64) || defined(__AVX__)
+#include <immintrin.h>
+#endif
+
+#include "rdr/bvh_cache.h"
+#include "rdr/interaction.h"
+#include "rdr/ray.h"
+#include "rdr/shape.h"
+
+RDR_NAMESPACE_BEGIN
+
+namespace detail_ {
+template <int Width>
+WideBVHNode<Width>::WideBVHNode() {
+  for (int axis = 0; axis < 3; ++axis) {
+    std::fill_n(low_bnd[axis], Width, Float_INF);
+    std::fill_n(upper_bnd[axis], Width, Float_MINUS_INF);
+  }
+  std::fill_n(offset, Width, -1);
+  std::fill_n(count, Width, 0);
+}
+
+template <int Width>
+void WideBVHNode<Width>::setBound(
+    int slot, const Vec3f &low, const Vec3f &upper) {
+  for (int axis = 0; axis < 3; ++axis) {
+    low_bnd[axis][slot]   = low[axis];
+    upper_bnd[axis][slot] = upper[axis];
+  }
+}
+
+namespace {
+/// 2^exponent, assembled from the bits since the exponent is always normal
+RDR_FORCEINLINE float ExponentToScale(int8_t exponent) {
+  const uint32_t bits = static_cast<uint32_t>(exponent + 127) << 23;
+  float scale;
+  std::memcpy(&scale, &bits, sizeof(scale));
+  return scale;
+}
+}  // namespace
+
+template <int Width>
+QuantizedWideBVHNode<Width>::QuantizedWideBVHNode(
+    const WideBVHNode<Width> &node) {
+  std::copy_n(node.offset, Width, offset);
+  std::copy_n(node.count, Width, count);
+
+  for (int axis = 0; axis < 3; ++axis) {
+    // The frame encloses the used slots only
+    float frame_low = Float_INF, frame_upper = Float_MINUS_INF;
+    for (int slot = 0; slot < Width; ++slot) {
+      if (node.low_bnd[axis][slot] > node.upper_bnd[axis][slot]) continue;
+      frame_low   = std::min(frame_low, node.low_bnd[axis][slot]);
+      frame_upper = std::max(frame_upper, node.upper_bnd[axis][slot]);
+    }
+    if (frame_low > frame_upper) frame_low = frame_upper = 0;
+    origin[axis] = frame_low;
+
+    // The smallest scale covering the frame, which must also be large enough
+    // to be seen by origin, such that unused slots decode to empty boxes
+    int e = -126;
+    if (frame_upper > frame_low) {
+      std::frexp((frame_upper - frame_low) / 255.0F, &e);
+      e = std::clamp(e, -126, 127);
+    }
+    while (e < 127 && (frame_low + 255.0F * ExponentToScale(e) < frame_upper ||
+                          frame_low + ExponentToScale(e) == frame_low))
+      ++e;
+    exponent[axis]    = static_cast<int8_t>(e);
+    const float scale = ExponentToScale(exponent[axis]);
+
+    for (int slot = 0; slot < Width; ++slot) {
+      const float low   = node.low_bnd[axis][slot];
+      const float upper = node.upper_bnd[axis][slot];
+      if (low > upper) {
+        q_low[axis][slot]   = 255;
+        q_upper[axis][slot] = 0;
+        continue;
+      }
+
+      // Round outwards, verified with the very same decoding
+      int q = std::clamp(
+          static_cast<int>(std::floor((low - frame_low) / scale)), 0, 255);
+      while (q > 0 && frame_low + static_cast<float>(q) * scale > low) --q;
+      q_low[axis][slot] = static_cast<uint8_t>(q);
+
+      q = std::clamp(
+          static_cast<int>(std::ceil((upper - frame_low) / scale)), 0, 255);
+      while (q < 255 && frame_low + static_cast<float>(q) * scale < upper) ++q;
+      q_upper[axis][slot] = static_cast<uint8_t>(q);
+    }
+  }
+}
+
+template <int Width>
+void QuantizedWideBVHNode<Width>::decode(
+    float low_bnd[3][Width], float upper_bnd[3][Width]) const {
+  for (int axis = 0; axis < 3; ++axis) {
+    const float scale = ExponentToScale(exponent[axis]);
+    for (int slot = 0; slot < Width; ++slot) {
+      low_bnd[axis][slot] =
+          origin[axis] + static_cast<float>(q_low[axis][slot]) * scale;
+      upper_bnd[axis][slot] =
+          origin[axis] + static_cast<float>(q_upper[axis][slot]) * scale;
+    }
+  }
+}
+}  // namespace detail_
+
+namespace {
+/// Per-ray constants of the slab test, shared by all nodes visited
+struct WideRay {
+  explicit WideRay(const Ray &ray) {
+    for (int axis = 0; axis < 3; ++axis) {
+      origin[axis]     = ray.origin[axis];
+      inv_dir[axis]    = ray.safe_inverse_direction[axis];
+      dir_is_neg[axis] = ray.direction[axis] < 0;
+    }
+  }
+
+  float origin[3];
+  float inv_dir[3];
+  bool dir_is_neg[3];
+};
+
+/**
+ * @brief Slab test of all children against [t_min, t_max]. Since the near and
+ * far planes are chosen by the sign of the direction, only one sub/mul pair is
+ * needed per plane. Return the bit mask of the hit children, and write their
+ * entrance distances into t_enter.
+ */
+template <int Width>
+int IntersectChildren(const float low_bnd[3][Width],
+    const float upper_bnd[3][Width], const WideRay &ray, float t_min,
+    float t_max, float *t_enter) {
+  int mask = 0;
+  for (int slot = 0; slot < Width; ++slot) {
+    float enter = t_min, exit = t_max;
+    for (int axis = 0; axis < 3; ++axis) {
+      const float near_plane = ray.dir_is_neg[axis] ? upper_bnd[axis][slot]
+                                                    : low_bnd[axis][slot];
+      const float far_plane  = ray.dir_is_neg[axis] ? low_bnd[axis][slot]
+                                                    : upper_bnd[axis][slot];
+      enter = std::max(
+          enter, (near_plane - ray.origin[axis]) * ray.inv_dir[axis]);
+      exit = std::min(exit, (far_plane - ray.origin[axis]) * ray.inv_dir[axis]);
+    }
+    t_enter[slot] = enter;
+    mask |= static_cast<int>(enter <= exit) << slot;
+  }
+  return mask;
+}
+
+#if defined(__SSE2__) || defined(_M_X64)
+template <>
+int IntersectChildren<4>(const float low_bnd[3][4],
+    const float upper_bnd[3][4], const WideRay &ray, float t_min,
+    float t_max, float *t_enter) {
+  __m128 enter = _mm_set1_ps(t_min);
+  __m128 exit  = _mm_set1_ps(t_max);
+  for (int axis = 0; axis < 3; ++axis) {
+    const bool neg       = ray.dir_is_neg[axis];
+    const __m128 origin  = _mm_set1_ps(ray.origin[axis]);
+    const __m128 inv_dir = _mm_set1_ps(ray.inv_dir[axis]);
+    const __m128 near_plane =
+        _mm_load_ps(neg ? upper_bnd[axis] : low_bnd[axis]);
+    const __m128 far_plane =
+        _mm_load_ps(neg ? low_bnd[axis] : upper_bnd[axis]);
+    enter =
+        _mm_max_ps(enter, _mm_mul_ps(_mm_sub_ps(near_plane, origin), inv_dir));
+    exit = _mm_min_ps(exit, _mm_mul_ps(_mm_sub_ps(far_plane, origin), inv_dir));
+  }
+  _mm_store_ps(t_enter, enter);
+  return _mm_movemask_ps(_mm_cmple_ps(enter, exit));
+}
+#endif
+
+#if defined(__AVX__)
+template <>
+int IntersectChildren<8>(const float low_bnd[3][8],
+    const float upper_bnd[3][8], const WideRay &ray, float t_min,
+    float t_max, float *t_enter) {
+  __m256 enter = _mm256_set1_ps(t_min);
+  __m256 exit  = _mm256_set1_ps(t_max);
+  for (int axis = 0; axis < 3; ++axis) {
+    const bool neg       = ray.dir_is_neg[axis];
+    const __m256 origin  = _mm256_set1_ps(ray.origin[axis]);
+    const __m256 inv_dir = _mm256_set1_ps(ray.inv_dir[axis]);
+    const __m256 near_plane =
+        _mm256_load_ps(neg ? upper_bnd[axis] : low_bnd[axis]);
+    const __m256 far_plane =
+        _mm256_load_ps(neg ? low_bnd[axis] : upper_bnd[axis]);
+    enter = _mm256_max_ps(
+        enter, _mm256_mul_ps(_mm256_sub_ps(near_plane, origin), inv_dir));
+    exit = _mm256_min_ps(
+        exit, _mm256_mul_ps(_mm256_sub_ps(far_plane, origin), inv_dir));
+  }
+  _mm256_store_ps(t_enter, enter);
+  return _mm256_movemask_ps(_mm256_cmp_ps(enter, exit, _CMP_LE_OQ));
+}
+#endif
+}  // namespace
+
+template <int Width>
+WideBVHAccel<Width>::WideBVHAccel() {
+  binary_tree.setHeuristicProfile(
+      TreeType::EHeuristicProfile::ESurfaceAreaHeuristic);
+}
+
+template <int Width>
+WideBVHAccel<Width>::WideBVHAccel(const Properties &props) {
+  detail_::ConfigureBVHTree(binary_tree, props);
+  triangles.double_precision =
+      props.getProperty<bool>("double_precision", false);
+  quantized = props.getProperty<bool>("quantized", false);
+}
+
+template <int Width>
+void WideBVHAccel<Width>::setTriangleMesh(
+    const ref<TriangleMeshResource> &mesh) {
+  Accel::setTriangleMesh(mesh);
+
+  const uint32_t &num_triangles = mesh->v_indices.size() / 3;
+  assert(mesh->v_indices.size() % 3 == 0);
+  for (uint32_t i = 0; i < num_triangles; ++i)
+    binary_tree.push_back(detail_::Triangle(i, mesh));
+}
+
+template <int Width>
+void WideBVHAccel<Width>::build() {
+  if (binary_tree.getBuildSettings().spatial_split_budget > 0)
+    detail_::BuildSpatialSplitBVH(binary_tree, mesh);
+  else
+    binary_tree.build();
+
+  // The wide nodes are no deeper than the binary ones, @see STACK_SIZE
+  if (TreeType::computeMaxDepth(binary_tree.getLinearNodes()) >
+      TreeType::CUTOFF_DEPTH)
+    Exception_("BVH{} is deeper than the traversal stack allows ({} levels)",
+        Width, TreeType::CUTOFF_DEPTH);
+
+  triangles.clear();
+  for (const auto &node : binary_tree.getNodes())
+    triangles.push_back(*mesh, node.getData().getTriangleIndex());
+
+  wide_nodes.clear();
+  const auto &linear_nodes = binary_tree.getLinearNodes();
+  if (!linear_nodes.empty()) {
+    const auto &root = linear_nodes[0];
+    if (root.isLeaf()) {
+      // Too few triangles to be split, still keep one node as the root
+      auto &node = wide_nodes.emplace_back();
+      node.setBound(0, root.low_bnd, root.upper_bnd);
+      node.offset[0] = root.offset;
+      node.count[0]  = root.getCount();
+    } else {
+      collapse(0);
+    }
+
+    bound = AABB(root.low_bnd, root.upper_bnd);
+  }
+
+  // The binary tree is no longer needed, but its builder is, see update()
+  TreeType released;
+  released.setHeuristicProfile(binary_tree.getHeuristicProfile());
+  released.setBuildSettings(binary_tree.getBuildSettings());
+  binary_tree = std::move(released);
+
+  quantized_nodes.clear();
+  if (quantized) {
+    quantized_nodes.reserve(wide_nodes.size());
+    for (const auto &node : wide_nodes) quantized_nodes.emplace_back(node);
+    wide_nodes.clear();
+    wide_nodes.shrink_to_fit();
+  }
+}
+
+template <int Width>
+bool WideBVHAccel<Width>::update() {
+  // The binary tree is released by build(), so there is nothing to refit
+  setTriangleMesh(mesh);
+  build();
+  return true;
+}
+
+template <int Width>
+int WideBVHAccel<Width>::collapse(int binary_index) {
+  const auto &linear_nodes = binary_tree.getLinearNodes();
+
+  // Greedily open the interior child with the largest surface area, i.e. the
+  // most likely to be hit, until all slots are occupied
+  int slots[Width];
+  int n_slots      = 0;
+  slots[n_slots++] = binary_index + 1;
+  slots[n_slots++] = linear_nodes[binary_index].offset;
+  while (n_slots < Width) {
+    int best_slot   = -1;
+    Float best_area = -1;
+    for (int slot = 0; slot < n_slots; ++slot) {
+      const auto &child = linear_nodes[slots[slot]];
+      if (child.isLeaf()) continue;
+
+      const Float area = AABB(child.low_bnd, child.upper_bnd).getSurfaceArea();
+      if (area > best_area) {
+        best_area = area;
+        best_slot = slot;
+      }
+    }
+
+    if (best_slot < 0) break;
+    const int opened = slots[best_slot];
+    slots[best_slot] = opened + 1;
+    slots[n_slots++] = linear_nodes[opened].offset;
+  }
+
+  const int wide_index = wide_nodes.size();
+  wide_nodes.emplace_back();
+  for (int slot = 0; slot < n_slots; ++slot) {
+    const auto &child = linear_nodes[slots[slot]];
+    const int32_t offset =
+        child.isLeaf() ? child.offset : collapse(slots[slot]);
+
+    // wide_nodes might be re-allocated during the recursion
+    auto &node = wide_nodes[wide_index];
+    node.setBound(slot, child.low_bnd, child.upper_bnd);
+    node.offset[slot] = offset;
+    node.count[slot]  = child.isLeaf() ? child.getCount() : 0;
+  }
+
+  return wide_index;
+}
+
+template <int Width>
+AABB WideBVHAccel<Width>::getBound() const {
+  return bound;
+}
+
+template <int Width>
+bool WideBVHAccel<Width>::intersectHit(Ray &ray, HitRecord &hit) const {
+  return traverse<false>(
+      ray, [&](Ray &local_ray, uint32_t span_left, uint32_t span_right) {
+        bool result = false;
+        for (uint32_t i = span_left; i < span_right; ++i)
+          result |= triangles.intersectHit(local_ray, i, *mesh, hit);
+        return result;
+      });
+}
+
+template <int Width>
+bool WideBVHAccel<Width>::occluded(const Ray &ray) const {
+  return traverse<true>(ray,
+      [&](const Ray &local_ray, uint32_t span_left, uint32_t span_right) {
+        for (uint32_t i = span_left; i < span_right; ++i)
+          if (triangles.occluded(local_ray, i, mesh)) return true;
+        return false;
+      });
+}
+
+template <int Width>
+size_t WideBVHAccel<Width>::getMemoryUsage() const {
+  return wide_nodes.capacity() * sizeof(NodeType) +
+         quantized_nodes.capacity() * sizeof(QuantizedNodeType) +
+         triangles.getMemoryUsage();
+}
+
+template <int Width>
+bool WideBVHAccel<Width>::save(std::ostream &stream) const {
+  triangles.save(stream);
+  if (quantized)
+    detail_::WriteCacheSection(stream, quantized_nodes);
+  else
+    detail_::WriteCacheSection(stream, wide_nodes);
+  return true;
+}
+
+template <int Width>
+bool WideBVHAccel<Width>::load(
+    std::istream &stream, const ref<TriangleMeshResource> &mesh) {
+  Accel::setTriangleMesh(mesh);
+  if (!triangles.load(stream, *mesh)) return false;
+  if (quantized ? !detail_::ReadCacheSection(stream, quantized_nodes)
+                : !detail_::ReadCacheSection(stream, wide_nodes))
+    return false;
+
+  // Children must be addressed in range. Unused slots are never hit, as long
+  // as their boxes stay empty.
+  const auto n_nodes     = static_cast<int64_t>(
+      quantized ? quantized_nodes.size() : wide_nodes.size());
+  const auto n_triangles = static_cast<int64_t>(triangles.size());
+  if (n_nodes == 0) return false;
+  // Children follow their parent, so one forward sweep settles the depths,
+  // which must stay below CUTOFF_DEPTH as the leaves are one level deeper
+  vector<int> depths(n_nodes, 0);
+  for (int64_t i = 0; i < n_nodes; ++i) {
+    if (depths[i] >= TreeType::CUTOFF_DEPTH) return false;
+    for (int slot = 0; slot < Width; ++slot) {
+      const int64_t offset = quantized ? quantized_nodes[i].offset[slot]
+                                       : wide_nodes[i].offset[slot];
+      const int64_t count  = quantized ? quantized_nodes[i].count[slot]
+                                       : wide_nodes[i].count[slot];
+      bool valid           = false;
+      if (count != 0)
+        valid = offset >= 0 && offset + count <= n_triangles;
+      else if (offset >= 0)
+        valid = offset > i && offset < n_nodes;
+      else if (quantized)
+        valid = quantized_nodes[i].q_low[0][slot] >
+                quantized_nodes[i].q_upper[0][slot];
+      else
+        valid =
+            wide_nodes[i].low_bnd[0][slot] > wide_nodes[i].upper_bnd[0][slot];
+      if (!valid) return false;
+      if (count == 0 && offset >= 0)
+        depths[offset] = std::max(depths[offset], depths[i] + 1);
+    }
+  }
+
+  return true;
+}
+
+template <int Width>
+template <bool AnyHit, typename RayType, typename LeafCallback>
+bool WideBVHAccel<Width>::traverse(
+    RayType &ray, LeafCallback callback) const {
+  if (wide_nodes.empty() && quantized_nodes.empty()) return false;
+
+  struct StackEntry {
+    int32_t offset;
+    uint32_t count;
+    Float t_enter;
+  };
+
+  const WideRay wide_ray(ray);
+  TraversalStats *stats = CurrentTraversalStats();
+  StackEntry stack[STACK_SIZE];
+  int stack_size      = 0;
+  stack[stack_size++] = {0, 0, ray.t_min};
+
+  bool result = false;
+  while (stack_size > 0) {
+    const StackEntry entry = stack[--stack_size];
+    // Culled by a closer hit found after the entry was pushed
+    if (entry.t_enter > ray.t_max) continue;
+
+    if (entry.count != 0) {
+      if (stats != nullptr) stats->primitive_tests += entry.count;
+      result |= callback(ray, entry.offset, entry.offset + entry.count);
+      if constexpr (AnyHit) {
+        if (result) return true;
+      }
+      continue;
+    }
+
+    if (stats != nullptr) ++stats->node_visits;
+    alignas(32) float t_enter[Width];
+    const int32_t *offsets;
+    const uint32_t *counts;
+    int mask;
+    if (quantized) {
+      const auto &node = quantized_nodes[entry.offset];
+      alignas(32) float low_bnd[3][Width], upper_bnd[3][Width];
+      node.decode(low_bnd, upper_bnd);
+      mask    = IntersectChildren<Width>(
+          low_bnd, upper_bnd, wide_ray, ray.t_min, ray.t_max, t_enter);
+      offsets = node.offset;
+      counts  = node.count;
+    } else {
+      const auto &node = wide_nodes[entry.offset];
+      mask    = IntersectChildren<Width>(node.low_bnd, node.upper_bnd,
+          wide_ray, ray.t_min, ray.t_max, t_enter);
+      offsets = node.offset;
+      counts  = node.count;
+    }
+
+    // Push the hit children sorted far-to-near, so the nearest is popped first
+    const int first = stack_size;
+    for (int slot = 0; slot < Width; ++slot) {
+      if (!(mask & (1 << slot))) continue;
+
+      const StackEntry child{offsets[slot], counts[slot], t_enter[slot]};
+      int i = stack_size++;
+      for (; i > first && stack[i - 1].t_enter < child.t_enter; --i)
+        stack[i] = stack[i - 1];
+      stack[i] = child;
+    }
+  }
+
+  return result;
+}
+
+template struct detail_::WideBVHNode<4>;
+template struct detail_::WideBVHNode<8>;
+template struct detail_::QuantizedWideBVHNode<4>;
+template struct detail_::QuantizedWideBVHNode<8>;
+template class WideBVHAccel<4>;
+template class WideBVHAccel<8>;
+
+RDR_NAMESPACE_END
@@ -5,11 +5,19 @@
  */
 
 #include <gtest/gtest.h>
+#include <omp.h>
+
+#include <fstream>
 
 #include "rdr/accel.h"
+#include "rdr/bvh_accel.h"
+#include "rdr/bvh_cache.h"
 #include "rdr/bvh_tree.h"
+#include "rdr/interaction.h"
 #include "rdr/ray.h"
 #include "rdr/rdr.h"
+#include "rdr/shape.h"
+#include "rdr/wide_bvh_accel.h"
 
 using namespace RDR_NAMESPACE_NAME;
 
@@ -131,3 +139,743 @@ TEST(BVH, EmptyTree) {
   EXPECT_FALSE(result);
   EXPECT_FALSE(callback_called);
 }
+
+namespace {
+// Collect the ids (first coordinate of center) of all objects hit by the ray
+vector<Float> CollectHits(const BVHTree<TestNode> &bvh_tree, Ray ray) {
+  vector<Float> hits;
+  bvh_tree.intersect(ray, [&](const Ray &local_ray, const TestObject &obj) {
+    Float t_in, t_out;
+    if (obj.getAABB().intersect(local_ray, &t_in, &t_out))
+      hits.push_back(obj.getCenter().x);
+    return false;
+  });
+  std::sort(hits.begin(), hits.end());
+  return hits;
+}
+
+// Boxes of random sizes in [min_size, min_size + size_range), with random
+// centers in [0, extent)^3
+vector<TestObject> MakeRandomBoxes(
+    int n_objects, Float extent, Float min_size, Float size_range) {
+  Sampler sampler;
+  sampler.setSeed(171);
+  vector<TestObject> objects;
+  for (int i = 0; i < n_objects; ++i) {
+    const Vec3f center(sampler.get1D(), sampler.get1D(), sampler.get1D());
+    const Float size = min_size + size_range * sampler.get1D();
+    objects.emplace_back(center * extent, size);
+  }
+  return objects;
+}
+
+// Build the objects into the tree with the given number of OpenMP threads
+void BuildWithThreads(int n_threads, const vector<TestObject> &objects,
+    BVHTree<TestNode>::EHeuristicProfile profile,
+    const BVHBuildSettings &settings, BVHTree<TestNode> &bvh_tree) {
+  const int max_threads = omp_get_max_threads();
+  omp_set_num_threads(n_threads);
+  bvh_tree.setHeuristicProfile(profile);
+  bvh_tree.setBuildSettings(settings);
+  for (const auto &obj : objects) bvh_tree.push_back(TestNode(obj));
+  bvh_tree.build();
+  omp_set_num_threads(max_threads);
+}
+
+// The layout of both trees must be bit-identical, not only equivalent
+void ExpectSameLayout(
+    const BVHTree<TestNode> &tree, const BVHTree<TestNode> &other_tree) {
+  const auto &nodes       = tree.getLinearNodes();
+  const auto &other_nodes = other_tree.getLinearNodes();
+  ASSERT_EQ(nodes.size(), other_nodes.size());
+  for (size_t i = 0; i < nodes.size(); ++i) {
+    ASSERT_EQ(nodes[i].offset, other_nodes[i].offset);
+    ASSERT_EQ(nodes[i].packed, other_nodes[i].packed);
+    ASSERT_EQ(nodes[i].low_bnd, other_nodes[i].low_bnd);
+    ASSERT_EQ(nodes[i].upper_bnd, other_nodes[i].upper_bnd);
+  }
+
+  ASSERT_EQ(tree.getNodes().size(), other_tree.getNodes().size());
+  for (size_t i = 0; i < tree.getNodes().size(); ++i) {
+    ASSERT_EQ(tree.getNodes()[i].getData().getCenter(),
+        other_tree.getNodes()[i].getData().getCenter());
+  }
+}
+}  // namespace
+
+TEST(BVH, SurfaceAreaHeuristicMatchesMedian) {
+  using TreeType = BVHTree<TestNode>;
+
+  TreeType median_tree, sah_tree;
+  sah_tree.setHeuristicProfile(
+      TreeType::EHeuristicProfile::ESurfaceAreaHeuristic);
+
+  BVHBuildSettings settings;
+  settings.sah_bins      = 8;
+  settings.max_leaf_size = 2;
+  sah_tree.setBuildSettings(settings);
+
+  // A clustered row of boxes plus a few outliers, so that SAH and median
+  // produce different topologies
+  for (int i = 0; i < 64; ++i) {
+    const TestObject obj(Vec3f(i * 0.1F, (i % 4) * 0.1F, 0), 0.05F);
+    median_tree.push_back(TestNode(obj));
+    sah_tree.push_back(TestNode(obj));
+  }
+  for (int i = 0; i < 4; ++i) {
+    const TestObject obj(Vec3f(100.0F + i, 0, 0), 0.5F);
+    median_tree.push_back(TestNode(obj));
+    sah_tree.push_back(TestNode(obj));
+  }
+
+  median_tree.build();
+  sah_tree.build();
+  ASSERT_EQ(median_tree.size(), sah_tree.size());
+
+  for (int i = 0; i < 8; ++i) {
+    const Ray ray(Vec3f(-1, i * 0.05F, 0), Vec3f(1, 0, 0));
+    EXPECT_EQ(CollectHits(median_tree, ray), CollectHits(sah_tree, ray));
+  }
+
+  const Ray miss_ray(Vec3f(-1, 10, 0), Vec3f(1, 0, 0));
+  EXPECT_TRUE(CollectHits(sah_tree, miss_ray).empty());
+}
+
+TEST(BVH, SurfaceAreaHeuristicCoincidentCentroids) {
+  using TreeType = BVHTree<TestNode>;
+
+  TreeType sah_tree;
+  sah_tree.setHeuristicProfile(
+      TreeType::EHeuristicProfile::ESurfaceAreaHeuristic);
+
+  // Binning cannot separate these, the builder must still terminate
+  for (int i = 0; i < 32; ++i)
+    sah_tree.push_back(TestNode(TestObject(Vec3f(0, 0, 0), 1.0F + i)));
+  sah_tree.build();
+
+  const Ray ray(Vec3f(-100, 0, 0), Vec3f(1, 0, 0));
+  EXPECT_EQ(CollectHits(sah_tree, ray).size(), 32);
+}
+
+TEST(BVH, ClosestHitMatchesBruteForce) {
+  using TreeType = BVHTree<TestNode>;
+
+  const auto objects = MakeRandomBoxes(256, 20.0F, 0.1F, 1.0F);
+  // The rays are independent of the boxes
+  Sampler sampler;
+  sampler.setSeed(172);
+  const auto get3D = [&sampler]() {
+    return Vec3f(sampler.get1D(), sampler.get1D(), sampler.get1D());
+  };
+
+  for (const auto profile : {TreeType::EHeuristicProfile::EMedianHeuristic,
+           TreeType::EHeuristicProfile::ESurfaceAreaHeuristic,
+           TreeType::EHeuristicProfile::ELinearHeuristic}) {
+    BVHBuildSettings settings;
+    settings.treelet_size = 5;
+
+    TreeType bvh_tree;
+    bvh_tree.setHeuristicProfile(profile);
+    bvh_tree.setBuildSettings(settings);
+    for (const auto &obj : objects) bvh_tree.push_back(TestNode(obj));
+    bvh_tree.build();
+
+    for (int i = 0; i < 128; ++i) {
+      const Vec3f origin    = get3D() * 30.0F - Vec3f(5.0F);
+      const Vec3f direction = Normalize(get3D() - Vec3f(0.5F));
+
+      // Reference: the nearest entrance point among all objects
+      Float expected = Float_INF;
+      for (const auto &obj : objects) {
+        Float t_in, t_out;
+        if (obj.getAABB().intersect(Ray(origin, direction), &t_in, &t_out))
+          expected = std::min(expected, t_in);
+      }
+
+      // Shrinking t_max on every hit exercises the culling in traversal
+      Ray ray(origin, direction);
+      const bool hit = bvh_tree.intersect(
+          ray, [](Ray &local_ray, const TestObject &obj) {
+            Float t_in, t_out;
+            if (!obj.getAABB().intersect(local_ray, &t_in, &t_out))
+              return false;
+            local_ray.setTimeMax(t_in);
+            return true;
+          });
+
+      EXPECT_EQ(hit, expected != Float_INF);
+      EXPECT_EQ(bvh_tree.occluded(Ray(origin, direction),
+                    [](const Ray &local_ray, const TestObject &obj) {
+                      Float t_in, t_out;
+                      return obj.getAABB().intersect(local_ray, &t_in, &t_out);
+                    }),
+          hit);
+      if (hit) {
+        EXPECT_FLOAT_EQ(ray.t_max, expected);
+      }
+    }
+  }
+}
+
+TEST(BVH, ParallelBuildMatchesSerial) {
+  using TreeType = BVHTree<TestNode>;
+
+  // Large enough for both the subtree tasks and the chunked binning
+  const auto objects =
+      MakeRandomBoxes(2 * TreeType::PARALLEL_BINNING_SIZE, 100.0F, 0.01F, 1.0F);
+
+  TreeType serial_tree, parallel_tree;
+  const auto profile = TreeType::EHeuristicProfile::ESurfaceAreaHeuristic;
+  BuildWithThreads(1, objects, profile, BVHBuildSettings(), serial_tree);
+  BuildWithThreads(4, objects, profile, BVHBuildSettings(), parallel_tree);
+  ExpectSameLayout(serial_tree, parallel_tree);
+}
+
+TEST(BVH, RadixSortIsStable) {
+  Sampler sampler;
+  sampler.setSeed(171);
+
+  // More than one chunk, and few distinct keys to observe the stability
+  vector<std::pair<uint64_t, int>> values;
+  for (int i = 0; i < 200000; ++i)
+    values.emplace_back(static_cast<uint64_t>(sampler.get1D() * 1000) << 20, i);
+
+  auto expected = values;
+  std::stable_sort(expected.begin(), expected.end(),
+      [](const auto &a, const auto &b) { return a.first < b.first; });
+  detail_::RadixSort(
+      values, 30, [](const auto &value) { return value.first; });
+  EXPECT_EQ(values, expected);
+}
+
+namespace {
+// The SAH cost of the flattened tree, up to the area of the root
+template <typename TreeType>
+Float ComputeSurfaceAreaCost(
+    const TreeType &tree, const BVHBuildSettings &settings) {
+  Float cost = 0;
+  for (const auto &node : tree.getLinearNodes()) {
+    const Float area = AABB(node.low_bnd, node.upper_bnd).getSurfaceArea();
+    cost += node.isLeaf() ? settings.intersection_cost * node.getCount() * area
+                          : settings.traversal_cost * area;
+  }
+  return cost;
+}
+}  // namespace
+
+TEST(BVH, TreeletRestructuringReducesCost) {
+  using TreeType = BVHTree<TestNode>;
+
+  const auto objects = MakeRandomBoxes(4096, 100.0F, 0.1F, 4.0F);
+
+  BVHBuildSettings settings;
+  TreeType linear_tree, restructured_tree;
+  for (auto *tree : {&linear_tree, &restructured_tree}) {
+    tree->setHeuristicProfile(TreeType::EHeuristicProfile::ELinearHeuristic);
+    tree->setBuildSettings(settings);
+    for (const auto &obj : objects) tree->push_back(TestNode(obj));
+    settings.treelet_size = TreeType::MAX_TREELET_SIZE;
+  }
+  linear_tree.build();
+  restructured_tree.build();
+
+  EXPECT_LT(ComputeSurfaceAreaCost(restructured_tree, settings),
+      ComputeSurfaceAreaCost(linear_tree, settings));
+  for (int i = 0; i < 32; ++i) {
+    const Ray ray(Vec3f(-1, i * 3.0F + 1.5F, 100 - i * 3.0F), Vec3f(1, 0, 0));
+    EXPECT_EQ(
+        CollectHits(restructured_tree, ray), CollectHits(linear_tree, ray));
+  }
+}
+
+TEST(BVH, ParallelLinearBuildMatchesSerial) {
+  using TreeType = BVHTree<TestNode>;
+
+  // Large enough for the parallel radix sort and the treelet tasks
+  const auto objects =
+      MakeRandomBoxes(2 * TreeType::PARALLEL_BINNING_SIZE, 100.0F, 0.01F, 1.0F);
+
+  BVHBuildSettings settings;
+  settings.treelet_size = TreeType::MAX_TREELET_SIZE;
+
+  TreeType serial_tree, parallel_tree;
+  const auto profile = TreeType::EHeuristicProfile::ELinearHeuristic;
+  BuildWithThreads(1, objects, profile, settings, serial_tree);
+  BuildWithThreads(4, objects, profile, settings, parallel_tree);
+  ExpectSameLayout(serial_tree, parallel_tree);
+}
+
+namespace {
+// A seeded soup of small random triangles and random rays through it. The
+// soup is intersected by brute force as reference
+struct TriangleSoup {
+  Sampler sampler;
+  ref<TriangleMeshResource> mesh;
+
+  explicit TriangleSoup(int n_triangles)
+      : mesh(Memory::alloc<TriangleMeshResource>()) {
+    sampler.setSeed(171);
+    for (int i = 0; i < n_triangles; ++i) {
+      const Vec3f center = get3D() * 10.0F - Vec3f(5.0F);
+      for (int j = 0; j < 3; ++j) {
+        mesh->v_indices.push_back(mesh->vertices.size());
+        mesh->vertices.push_back(center + get3D() - Vec3f(0.5F));
+      }
+    }
+  }
+
+  Vec3f get3D() {
+    return Vec3f(sampler.get1D(), sampler.get1D(), sampler.get1D());
+  }
+
+  // A random direction from a random origin in a cube of the given extent
+  Ray sampleRay(Float extent = 16.0F) {
+    const Vec3f origin = get3D() * extent - Vec3f(extent / 2);
+    return Ray(origin, Normalize(get3D() - Vec3f(0.5F)));
+  }
+};
+}  // namespace
+
+TEST(BVH, AccelMatchesBruteForce) {
+  TriangleSoup soup(512);
+  const auto &mesh = soup.mesh;
+
+  Accel reference;
+  reference.setTriangleMesh(mesh);
+  reference.build();
+
+  Properties median_props;
+  median_props.setProperty<std::string>("heuristic", "median");
+  Properties double_props;
+  double_props.setProperty<bool>("double_precision", true);
+  Properties linear_props;
+  linear_props.setProperty<std::string>("heuristic", "lbvh");
+  linear_props.setProperty<int>("treelet_size", 7);
+  Properties spatial_props;
+  spatial_props.setProperty<Float>("spatial_split_budget", 0.5F);
+  Properties quantized_props;
+  quantized_props.setProperty<bool>("quantized", true);
+
+  vector<ref<Accel>> accels = {make_ref<BVHAccel>(),
+      make_ref<BVHAccel>(median_props), make_ref<BVHAccel>(double_props),
+      make_ref<BVHAccel>(linear_props), make_ref<BVHAccel>(spatial_props),
+      make_ref<BVH4Accel>(), make_ref<BVH8Accel>(double_props),
+      make_ref<BVH8Accel>(linear_props), make_ref<BVH4Accel>(spatial_props),
+      make_ref<BVH4Accel>(quantized_props),
+      make_ref<BVH8Accel>(quantized_props)};
+  for (auto &accel : accels) {
+    accel->setTriangleMesh(mesh);
+    accel->build();
+  }
+
+  for (int i = 0; i < 256; ++i) {
+    const Ray sampled_ray = soup.sampleRay();
+
+    Ray expected_ray = sampled_ray;
+    SurfaceInteraction expected_interaction;
+    const bool expected_hit =
+        reference.intersect(expected_ray, expected_interaction);
+
+    // A shadow ray ending right before the closest hit is never occluded
+    const Ray shadow_ray(sampled_ray.origin, sampled_ray.direction,
+        RAY_DEFAULT_MIN,
+        expected_hit ? expected_ray.t_max * 0.99F : RAY_DEFAULT_MAX);
+    EXPECT_EQ(reference.occluded(sampled_ray), expected_hit);
+    EXPECT_FALSE(reference.occluded(shadow_ray));
+
+    for (const auto &accel : accels) {
+      EXPECT_EQ(accel->occluded(sampled_ray), expected_hit);
+      EXPECT_FALSE(accel->occluded(shadow_ray));
+
+      Ray ray = sampled_ray;
+      SurfaceInteraction interaction;
+      ASSERT_EQ(accel->intersect(ray, interaction), expected_hit);
+      if (expected_hit) {
+        EXPECT_FLOAT_EQ(ray.t_max, expected_ray.t_max);
+        EXPECT_NEAR(interaction.p.x, expected_interaction.p.x, 1e-4);
+        EXPECT_NEAR(interaction.p.y, expected_interaction.p.y, 1e-4);
+        EXPECT_NEAR(interaction.p.z, expected_interaction.p.z, 1e-4);
+      }
+    }
+  }
+}
+
+TEST(BVH, RefitAndUpdateTrackMovedVertices) {
+  using TreeType = BVHTree<detail_::BVHTriangleNode>;
+
+  TriangleSoup soup(2048);
+  const auto &mesh = soup.mesh;
+
+  TreeType tree;
+  tree.setHeuristicProfile(TreeType::EHeuristicProfile::ESurfaceAreaHeuristic);
+  for (uint32_t i = 0; i < 2048; ++i)
+    tree.push_back(detail_::Triangle(i, mesh));
+  tree.build();
+  Properties linear_props;
+  linear_props.setProperty<std::string>("heuristic", "lbvh");
+  linear_props.setProperty<int>("treelet_size", 7);
+  vector<ref<Accel>> accels = {make_ref<BVHAccel>(),
+      make_ref<BVHAccel>(linear_props), make_ref<BVH4Accel>(linear_props)};
+  for (auto &accel : accels) {
+    accel->setTriangleMesh(mesh);
+    accel->build();
+  }
+
+  // Nothing moved, nothing to rebuild
+  const Float built_cost = tree.getSurfaceAreaCost();
+  EXPECT_EQ(tree.update(), 0);
+  EXPECT_FLOAT_EQ(tree.getSurfaceAreaCost(), built_cost);
+
+  // Scatter the triangles of one corner over the whole soup
+  auto &resource = *mesh.get();
+  for (size_t i = 0; i < resource.vertices.size(); i += 3) {
+    if (resource.vertices[i].x > -2.5F) continue;
+    const Vec3f offset =
+        soup.get3D() * 10.0F - Vec3f(5.0F) - resource.vertices[i];
+    for (size_t j = i; j < i + 3; ++j) resource.vertices[j] += offset;
+  }
+
+  tree.refit();
+  const Float refit_cost = tree.getSurfaceAreaCost();
+  EXPECT_GT(refit_cost, built_cost);
+  EXPECT_GT(tree.update(), 0);
+  EXPECT_LT(tree.getSurfaceAreaCost(), refit_cost);
+  for (auto &accel : accels) EXPECT_TRUE(accel->update());
+
+  Accel reference;
+  reference.setTriangleMesh(mesh);
+  reference.build();
+  for (int i = 0; i < 256; ++i) {
+    const Ray sampled_ray = soup.sampleRay();
+
+    Ray expected_ray = sampled_ray;
+    SurfaceInteraction expected_interaction;
+    const bool expected_hit =
+        reference.intersect(expected_ray, expected_interaction);
+
+    Ray tree_ray = sampled_ray;
+    const bool tree_hit = tree.intersect(
+        tree_ray, [&](Ray &local_ray, const detail_::Triangle &triangle) {
+          SurfaceInteraction interaction;
+          return triangle.intersect(local_ray, interaction);
+        });
+    ASSERT_EQ(tree_hit, expected_hit);
+    if (expected_hit) EXPECT_FLOAT_EQ(tree_ray.t_max, expected_ray.t_max);
+
+    for (const auto &accel : accels) {
+      Ray ray = sampled_ray;
+      SurfaceInteraction interaction;
+      ASSERT_EQ(accel->intersect(ray, interaction), expected_hit);
+      if (expected_hit) EXPECT_FLOAT_EQ(ray.t_max, expected_ray.t_max);
+    }
+  }
+}
+
+TEST(BVH, StatsDescribeTheTraversalWork) {
+  using TreeType = BVHTree<TestNode>;
+
+  TreeType tree;
+  tree.setHeuristicProfile(TreeType::EHeuristicProfile::ESurfaceAreaHeuristic);
+  for (const auto &obj : MakeRandomBoxes(1024, 100.0F, 1.0F, 0.0F))
+    tree.push_back(TestNode(obj));
+  tree.build();
+
+  const BVHStats stats = tree.getStats();
+  EXPECT_EQ(stats.n_leaves, stats.n_interior_nodes + 1);
+  EXPECT_EQ(stats.n_references, 1024);
+  EXPECT_FLOAT_EQ(stats.sah_cost, tree.getSurfaceAreaCost());
+  EXPECT_EQ(stats.leaf_depths.size(), stats.max_depth + 1);
+  int n_leaves = 0, n_references = 0;
+  for (int depth : stats.leaf_depths) n_leaves += depth;
+  for (size_t size = 0; size < stats.leaf_sizes.size(); ++size)
+    n_references += size * stats.leaf_sizes[size];
+  EXPECT_EQ(n_leaves, stats.n_leaves);
+  EXPECT_EQ(n_references, stats.n_references);
+
+  // Counters are only touched while bound to the thread
+  TraversalStats traversal_stats;
+  int n_tests = 0;
+  const auto count_tests = [&](Ray &, const TestObject &) {
+    ++n_tests;
+    return false;
+  };
+  Ray ray(Vec3f(-1, 50, 50), Vec3f(1, 0, 0));
+  tree.intersect(ray, count_tests);
+  EXPECT_EQ(traversal_stats.node_visits, 0);
+  {
+    const TraversalStatsScope scope(traversal_stats);
+    tree.intersect(ray, count_tests);
+  }
+  tree.intersect(ray, count_tests);
+  EXPECT_GT(traversal_stats.node_visits, 0);
+  EXPECT_LE(
+      traversal_stats.node_visits, stats.n_interior_nodes + stats.n_leaves);
+  EXPECT_EQ(traversal_stats.primitive_tests, n_tests / 3);
+  EXPECT_EQ(CurrentTraversalStats(), nullptr);
+}
+
+TEST(BVH, QuantizedNodesAreConservative) {
+  Sampler sampler;
+  sampler.setSeed(171);
+
+  for (int i = 0; i < 256; ++i) {
+    // Far from the origin, where the rounding of the frame matters most
+    const Vec3f base =
+        Vec3f(sampler.get1D(), sampler.get1D(), sampler.get1D()) * 2000.0F -
+        Vec3f(1000.0F);
+    detail_::WideBVHNode<8> node;
+    for (int slot = 0; slot < 6; ++slot) {
+      const Vec3f low =
+          base + Vec3f(sampler.get1D(), sampler.get1D(), sampler.get1D());
+      // Flat boxes, e.g. of axis-aligned triangles, on some axes
+      Vec3f extent(sampler.get1D(), sampler.get1D(), sampler.get1D());
+      if (slot % 3 == 0) extent[slot % 2] = 0;
+      node.setBound(slot, low, low + extent * 0.01F);
+      node.offset[slot] = slot;
+      node.count[slot]  = 1;
+    }
+
+    const detail_::QuantizedWideBVHNode<8> quantized(node);
+    alignas(32) float low_bnd[3][8], upper_bnd[3][8];
+    quantized.decode(low_bnd, upper_bnd);
+    for (int axis = 0; axis < 3; ++axis) {
+      for (int slot = 0; slot < 6; ++slot) {
+        EXPECT_LE(low_bnd[axis][slot], node.low_bnd[axis][slot]);
+        EXPECT_GE(upper_bnd[axis][slot], node.upper_bnd[axis][slot]);
+        // At most one step on each side, which is 2^-7 for the frame of
+        // about 1 unit wide
+        EXPECT_LE(upper_bnd[axis][slot] - low_bnd[axis][slot],
+            node.upper_bnd[axis][slot] - node.low_bnd[axis][slot] +
+                2.0F / 128.0F);
+      }
+
+      // Unused slots stay empty
+      for (int slot = 6; slot < 8; ++slot)
+        EXPECT_GT(low_bnd[axis][slot], upper_bnd[axis][slot]);
+    }
+  }
+
+  // The quantized nodes take about half of the memory
+  const auto mesh = TriangleSoup(4096).mesh;
+  Properties quantized_props;
+  quantized_props.setProperty<bool>("quantized", true);
+  BVH8Accel accel, quantized_accel(quantized_props);
+  for (Accel *target : {(Accel *)&accel, (Accel *)&quantized_accel}) {
+    target->setTriangleMesh(mesh);
+    target->build();
+  }
+  const size_t triangle_bytes = 4096 * (3 * sizeof(Vec3f) + sizeof(uint32_t));
+  EXPECT_LT(quantized_accel.getMemoryUsage() - triangle_bytes,
+      (accel.getMemoryUsage() - triangle_bytes) * 6 / 10);
+}
+
+TEST(BVH, PacketTraversalMatchesSingleRays) {
+  TriangleSoup soup(512);
+  const auto &mesh = soup.mesh;
+
+  vector<ref<Accel>> accels = {make_ref<BVHAccel>(), make_ref<BVH4Accel>()};
+  for (auto &accel : accels) {
+    accel->setTriangleMesh(mesh);
+    accel->build();
+  }
+
+  for (int packet = 0; packet < 64; ++packet) {
+    // Even packets are coherent rays through a small cone, odd ones are not
+    const Ray center = soup.sampleRay();
+    const Float spread = packet % 2 == 0 ? 0.1F : 2.0F;
+
+    Ray rays[RAY_PACKET_SIZE];
+    for (auto &ray : rays) {
+      const Vec3f jitter = soup.get3D() - Vec3f(0.5F);
+      ray = Ray(center.origin, Normalize(center.direction + jitter * spread));
+    }
+
+    // Every third ray is left out of the packet
+    RayMask mask = 0;
+    for (int i = 0; i < RAY_PACKET_SIZE; ++i)
+      if (i % 3 != 0) mask |= RayMask(1) << i;
+
+    for (const auto &accel : accels) {
+      Ray packet_rays[RAY_PACKET_SIZE];
+      SurfaceInteraction interactions[RAY_PACKET_SIZE];
+      for (int i = 0; i < RAY_PACKET_SIZE; ++i) packet_rays[i] = rays[i];
+      const RayMask hits =
+          accel->intersectPacket(packet_rays, interactions, mask);
+
+      for (int i = 0; i < RAY_PACKET_SIZE; ++i) {
+        Ray ray = rays[i];
+        SurfaceInteraction interaction;
+        const bool hit =
+            IsRayActive(mask, i) && accel->intersect(ray, interaction);
+        ASSERT_EQ(IsRayActive(hits, i), hit);
+        EXPECT_EQ(packet_rays[i].t_max, ray.t_max);
+        if (hit) EXPECT_EQ(interactions[i].p, interaction.p);
+      }
+    }
+  }
+}
+
+TEST(BVH, CacheRoundTrip) {
+  TriangleSoup soup(512);
+  const auto &mesh = soup.mesh;
+  const fs::path directory =
+      fs::temp_directory_path() / "rdr_bvh_cache_tests";
+
+  for (const std::string type : {"bvh", "bvh4", "bvh8"}) {
+    Properties props;
+    props.setProperty<std::string>("type", type);
+    props.setProperty<bool>("quantized", type == "bvh8");
+    auto accel = CreateAccel(props);
+    accel->setTriangleMesh(mesh);
+    accel->build();
+
+    const uint64_t key = HashBytes(type.data(), type.size());
+    const BVHCache cache(directory, key);
+    ASSERT_TRUE(cache.save(*mesh, *accel));
+
+    auto loaded_mesh  = Memory::alloc<TriangleMeshResource>();
+    auto loaded_accel = CreateAccel(props);
+    ASSERT_TRUE(cache.load(loaded_mesh, *loaded_accel));
+    EXPECT_EQ(loaded_mesh->vertices, mesh->vertices);
+    EXPECT_EQ(loaded_mesh->v_indices, mesh->v_indices);
+
+    // The restored structure must be traversed exactly like the built one
+    for (int i = 0; i < 64; ++i) {
+      Ray expected_ray = soup.sampleRay(), ray = expected_ray;
+      SurfaceInteraction expected_interaction, interaction;
+      ASSERT_EQ(loaded_accel->intersect(ray, interaction),
+          accel->intersect(expected_ray, expected_interaction));
+      EXPECT_EQ(ray.t_max, expected_ray.t_max);
+    }
+
+    // Another key or a truncated file is a miss
+    auto missed_mesh = Memory::alloc<TriangleMeshResource>();
+    EXPECT_FALSE(BVHCache(directory, key + 1)
+                     .load(missed_mesh, *CreateAccel(props)));
+    fs::resize_file(cache.getPath(), fs::file_size(cache.getPath()) / 2);
+    EXPECT_FALSE(cache.load(missed_mesh, *CreateAccel(props)));
+    EXPECT_TRUE(missed_mesh->vertices.empty());
+  }
+
+  fs::remove_all(directory);
+}
+
+TEST(BVH, SpatialSplitsClipSlivers) {
+  using TreeType = BVHTree<detail_::BVHTriangleNode>;
+
+  // Long diagonal slivers, whose boxes overlap a lot under object splits
+  Sampler sampler;
+  sampler.setSeed(171);
+  auto mesh = Memory::alloc<TriangleMeshResource>();
+  for (int i = 0; i < 256; ++i) {
+    const Vec3f start(sampler.get1D(), sampler.get1D(), 0);
+    const Vec3f offset(0, 0, 0.01F);
+    for (const Vec3f &vertex :
+        {start * 2.0F, Vec3f(10.0F) - start * 2.0F, start * 2.0F + offset}) {
+      mesh->v_indices.push_back(mesh->vertices.size());
+      mesh->vertices.push_back(vertex);
+    }
+  }
+
+  BVHBuildSettings settings;
+  TreeType object_tree, spatial_tree;
+  object_tree.setHeuristicProfile(
+      TreeType::EHeuristicProfile::ESurfaceAreaHeuristic);
+  object_tree.setBuildSettings(settings);
+  for (uint32_t i = 0; i < 256; ++i)
+    object_tree.push_back(detail_::Triangle(i, mesh));
+  object_tree.build();
+
+  settings.spatial_split_budget = 1.0F;
+  spatial_tree.setBuildSettings(settings);
+  detail_::BuildSpatialSplitBVH(spatial_tree, mesh);
+
+  // Clipped references are duplicated, within the budget
+  EXPECT_GT(spatial_tree.getNodes().size(), 256);
+  EXPECT_LE(spatial_tree.getNodes().size(), 512);
+  EXPECT_LT(ComputeSurfaceAreaCost(spatial_tree, settings),
+      ComputeSurfaceAreaCost(object_tree, settings));
+}
+
+TEST(BVH, InstancesShareObjectSpaceAccel) {
+  TriangleSoup soup(256);
+
+  const fs::path directory = fs::temp_directory_path() / "rdr_instance_tests";
+  fs::create_directories(directory);
+  const fs::path path = directory / "soup.obj";
+  {
+    std::ofstream stream(path);
+    for (const auto &vertex : soup.mesh->vertices)
+      stream << format("v {} {} {}\n", vertex.x, vertex.y, vertex.z);
+    for (size_t i = 0; i < soup.mesh->v_indices.size(); i += 3)
+      stream << format("f {} {} {}\n", i + 1, i + 2, i + 3);
+  }
+
+  // Rotation around z, non-uniform scaling and a translation
+  const Mat4f transform = {
+      { 0, 2, 0, 0},
+      {-1, 0, 0, 0},
+      { 0, 0, 3, 0},
+      { 0, 0, 0, 1}
+  };
+  const auto make_mesh = [&](const Vec3f &translate, bool instanced) {
+    Properties props;
+    props.setProperty<std::string>("path", path.string());
+    props.setProperty<Mat4f>("transform", transform);
+    props.setProperty<Vec3f>("translate", translate);
+    props.setProperty<bool>("instanced", instanced);
+    return make_ref<TriangleMesh>(props);
+  };
+
+  const auto instance       = make_mesh(Vec3f(1, 2, 3), true);
+  const auto other_instance = make_mesh(Vec3f(-4, 0, 0), true);
+  const auto baked          = make_mesh(Vec3f(1, 2, 3), false);
+  EXPECT_EQ(instance->getMeshResource().get(),
+      other_instance->getMeshResource().get());
+  EXPECT_NE(instance->getMeshResource().get(), baked->getMeshResource().get());
+  EXPECT_NEAR(instance->area(), baked->area(), 1e-3F * baked->area());
+  EXPECT_NEAR(instance->area(), other_instance->area(), 1e-3F);
+
+  // The next scene no longer shares with the instances of this one
+  TriangleMesh::ClearSharedMeshes();
+  EXPECT_NE(make_mesh(Vec3f(1, 2, 3), true)->getMeshResource().get(),
+      instance->getMeshResource().get());
+
+  // Intersecting the instance must match the mesh baked in world space
+  for (int i = 0; i < 256; ++i) {
+    const Ray sampled_ray = soup.sampleRay(32.0F);
+
+    Ray expected_ray = sampled_ray, ray = sampled_ray;
+    SurfaceInteraction expected_interaction, interaction;
+    const bool hit = baked->intersect(expected_ray, expected_interaction);
+    ASSERT_EQ(instance->intersect(ray, interaction), hit);
+    EXPECT_EQ(instance->occluded(sampled_ray), hit);
+    if (!hit) continue;
+
+    EXPECT_NEAR(ray.t_max, expected_ray.t_max, 1e-3F);
+    for (int j = 0; j < 3; ++j) {
+      EXPECT_NEAR(interaction.p[j], expected_interaction.p[j], 1e-3F);
+      EXPECT_NEAR(
+          interaction.normal[j], expected_interaction.normal[j], 1e-3F);
+    }
+  }
+
+  // Packets are mapped into object space as a whole
+  Ray rays[RAY_PACKET_SIZE], packet_rays[RAY_PACKET_SIZE];
+  SurfaceInteraction interactions[RAY_PACKET_SIZE];
+  for (int i = 0; i < RAY_PACKET_SIZE; ++i) {
+    const Vec3f jitter = soup.get3D() - Vec3f(0.5F);
+    rays[i] = Ray(Vec3f(0, 0, -20), Normalize(Vec3f(jitter.x, jitter.y, 1)));
+    packet_rays[i] = rays[i];
+  }
+  const RayMask hits = instance->intersectPacket(
+      packet_rays, interactions, (RayMask(1) << RAY_PACKET_SIZE) - 1);
+  for (int i = 0; i < RAY_PACKET_SIZE; ++i) {
+    SurfaceInteraction interaction;
+    ASSERT_EQ(IsRayActive(hits, i), instance->intersect(rays[i], interaction));
+    EXPECT_EQ(packet_rays[i].t_max, rays[i].t_max);
+    if (IsRayActive(hits, i)) EXPECT_EQ(interactions[i].p, interaction.p);
+  }
+
+  fs::remove_all(directory);
+}
@@ -0,0 +1,212 @@
+/**
+ * @file film_tests.cpp
+ * @brief Tests for the accumulation of samples on Film
+ * @version 0.1
+ */
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <numeric>
+
+#include "rdr/factory.h"
+#include "rdr/film.h"
+#include "rdr/math_utils.h"
+#include "rdr/object.h"
+#include "rdr/properties.h"
+#include "rdr/rdr.h"
+#include "rdr/rfilter.h"
+
+using namespace RDR_NAMESPACE_NAME;
+
+namespace {
+// A preprocessed film of the given resolution and reconstruction filter
+ref<Film> MakeFilm(const Vec2i &resolution, const Properties &filter_props) {
+  Properties film_props;
+  film_props.setProperty<Vec2i>("resolution", resolution);
+  film_props.setProperty<int>("block_side_length", 8);
+  auto film = make_ref<Film>(film_props);
+
+  CrossConfigurationContext context;
+  context.filter = RDR_CREATE_CLASS(ReconstructionFilter, filter_props);
+  film->crossConfiguration(context);
+  film->preprocess(PreprocessContext{});
+  return film;
+}
+
+void ExpectImagesNear(const Film &film, const Film &reference) {
+  vector<Vec3f> image, reference_image;
+  film.exportImageToArray(image);
+  reference.exportImageToArray(reference_image);
+  ASSERT_EQ(image.size(), reference_image.size());
+  for (size_t i = 0; i < image.size(); ++i)
+    for (int c = 0; c < 3; ++c)
+      EXPECT_NEAR(image[i][c], reference_image[i][c], 1e-4);
+
+  const Vec2i resolution = film.getResolution();
+  for (int y = 0; y < resolution.y; ++y) {
+    for (int x = 0; x < resolution.x; ++x) {
+      const PixelMoments &moments           = film.getMoments(x, y);
+      const PixelMoments &reference_moments = reference.getMoments(x, y);
+      EXPECT_EQ(moments.count, reference_moments.count);
+      EXPECT_NEAR(moments.sum, reference_moments.sum, 1e-4);
+      EXPECT_NEAR(moments.sum_squared, reference_moments.sum_squared, 1e-4);
+    }
+  }
+}
+}  // namespace
+
+TEST(Film, TilesMatchSharedCommits) {
+  // Neither dimension is a multiple of the tile size
+  const Vec2i resolution(37, 29);
+  constexpr int TILE_SIZE = 8;
+  Factory::doRegisterAllClasses();
+
+  for (const std::string type : {"box", "gaussian", "mitchell"}) {
+    Properties filter_props;
+    filter_props.setProperty<std::string>("type", type);
+    filter_props.setProperty<Float>("radius", type == "box" ? 0.5F : 1.5F);
+    auto film      = MakeFilm(resolution, filter_props);
+    auto reference = MakeFilm(resolution, filter_props);
+
+    Sampler sampler;
+    sampler.setSeed(171);
+    for (int y = 0; y < resolution.y; y += TILE_SIZE) {
+      for (int x = 0; x < resolution.x; x += TILE_SIZE) {
+        const Vec2i offset(x, y);
+        FilmTile tile(
+            *film, offset, Min(Vec2i(TILE_SIZE), resolution - offset));
+        for (int dy = 0; dy < tile.getSize().y; ++dy) {
+          for (int dx = 0; dx < tile.getSize().x; ++dx) {
+            for (int sample = 0; sample < 4; ++sample) {
+              const Vec2f pos = Cast<Float>(offset + Vec2i(dx, dy)) +
+                                Vec2f(sampler.get1D(), sampler.get1D());
+              const Vec3f value(sampler.get1D(), sampler.get1D(), 1.0F);
+              tile.commitSample(pos, value);
+              reference->commitSample(pos, value);
+            }
+          }
+        }
+        film->mergeTile(tile);
+      }
+    }
+
+    ExpectImagesNear(*film, *reference);
+  }
+}
+
+TEST(Film, FilterTableMatchesTheFilter) {
+  Factory::doRegisterAllClasses();
+  for (const std::string type : {"box", "gaussian", "mitchell"}) {
+    Properties filter_props;
+    filter_props.setProperty<std::string>("type", type);
+    filter_props.setProperty<Float>("radius", 2.0F);
+    const auto filter = RDR_CREATE_CLASS(ReconstructionFilter, filter_props);
+    const FilterTable table(*filter);
+
+    for (Float x = -2.5F; x <= 2.5F; x += 0.0625F) {
+      for (Float y = -2.5F; y <= 2.5F; y += 0.0625F) {
+        const Vec2f pos(x, y);
+        EXPECT_NEAR(table.evaluate(pos), filter->evaluate(pos), 1e-2)
+            << type << " at " << x << ", " << y;
+      }
+    }
+  }
+}
+
+TEST(Film, SnapshotWriterWritesInTheBackground) {
+  Factory::doRegisterAllClasses();
+  auto film = MakeFilm(Vec2i(16, 16), Properties{});
+  film->commitSample(Vec2f(4.5F, 4.5F), Vec3f(1.0F));
+
+  const fs::path path = fs::temp_directory_path() / "rdr_film_snapshot.exr";
+  fs::remove(path);
+  {
+    FilmSnapshotWriter writer(*film, path, 0.01F);
+    for (int i = 0; i < 100 && !fs::exists(path); ++i)
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+
+  EXPECT_TRUE(fs::exists(path));
+  fs::remove(path);
+}
+
+TEST(Film, CheckpointRestoresTheAccumulation) {
+  Factory::doRegisterAllClasses();
+  Properties filter_props;
+  filter_props.setProperty<std::string>("type", "gaussian");
+  filter_props.setProperty<Float>("radius", 1.5F);
+  auto film     = MakeFilm(Vec2i(19, 13), filter_props);
+  auto restored = MakeFilm(Vec2i(19, 13), filter_props);
+
+  Sampler sampler;
+  for (int i = 0; i < 512; ++i) {
+    const Vec2f pos(sampler.get1D() * 19, sampler.get1D() * 13);
+    film->commitSample(pos, Vec3f(sampler.get1D(), sampler.get1D(), 1.0F));
+  }
+  film->getLightPixel(3, 4) += Vec3f(0.25F);
+
+  const fs::path path = fs::temp_directory_path() / "rdr_film_checkpoint.bin";
+  FilmCheckpoint checkpoint;
+  checkpoint.pass    = 3;
+  checkpoint.samples = 4;
+  ASSERT_TRUE(film->saveCheckpoint(path, checkpoint));
+
+  const FilmCheckpoint loaded = restored->loadCheckpoint(path);
+  EXPECT_EQ(loaded.pass, 3);
+  EXPECT_EQ(loaded.samples, 4);
+  ExpectImagesNear(*restored, *film);
+
+  // A checkpoint never applies to a film of another resolution
+  auto other = MakeFilm(Vec2i(13, 19), filter_props);
+  EXPECT_THROW(other->loadCheckpoint(path), rdr_exception);
+  fs::remove(path);
+}
+
+TEST(Film, TileOrdersVisitEveryTileOnce) {
+  for (const Vec2i n_tiles : {Vec2i(8, 8), Vec2i(13, 5), Vec2i(1, 7)}) {
+    for (const auto order :
+        {ETileOrder::EScanline, ETileOrder::EMorton, ETileOrder::EHilbert}) {
+      vector<int> tiles = GetTileOrder(n_tiles, order);
+      std::sort(tiles.begin(), tiles.end());
+      vector<int> expected(n_tiles.x * n_tiles.y);
+      std::iota(expected.begin(), expected.end(), 0);
+      EXPECT_EQ(tiles, expected);
+    }
+  }
+
+  // On a power-of-two grid, consecutive tiles along the Hilbert curve are
+  // always neighbours
+  const Vec2i n_tiles(8, 8);
+  const vector<int> tiles = GetTileOrder(n_tiles, ETileOrder::EHilbert);
+  for (size_t i = 1; i < tiles.size(); ++i) {
+    const int dx = std::abs(tiles[i] % n_tiles.x - tiles[i - 1] % n_tiles.x);
+    const int dy = std::abs(tiles[i] / n_tiles.x - tiles[i - 1] / n_tiles.x);
+    EXPECT_EQ(dx + dy, 1) << "between tiles " << i - 1 << " and " << i;
+  }
+}
+
+TEST(Film, PixelMomentsEstimateTheRelativeError) {
+  PixelMoments moments;
+  EXPECT_EQ(moments.getRelativeError(), std::numeric_limits<Float>::infinity());
+
+  // Converged pixels have no error, black ones included
+  for (int i = 0; i < 8; ++i) moments.add(0.5F);
+  EXPECT_NEAR(moments.getRelativeError(), 0.0F, 1e-6);
+  PixelMoments black;
+  for (int i = 0; i < 8; ++i) black.add(0.0F);
+  EXPECT_EQ(black.getRelativeError(), 0.0F);
+
+  // Alternating 0 and 1 have a mean of 0.5 and a variance of n / 4 / (n - 1)
+  PixelMoments noisy;
+  for (int i = 0; i < 100; ++i) noisy.add(static_cast<Float>(i % 2));
+  const double expected = std::sqrt(100.0 / 4 / 99 / 100) / 0.5;
+  EXPECT_NEAR(noisy.getRelativeError(), expected, 1e-5);
+
+  // Merging is the same as adding the samples to one pixel
+  PixelMoments merged = moments;
+  merged.merge(noisy);
+  for (int i = 0; i < 100; ++i) moments.add(static_cast<Float>(i % 2));
+  EXPECT_EQ(merged.count, moments.count);
+  EXPECT_NEAR(merged.getRelativeError(), moments.getRelativeError(), 1e-6);
+}
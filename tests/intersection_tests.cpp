@@ -199,3 +199,126 @@ TEST(TriangleIntersect, MultiTriangleMesh_HitCorrectTriangle) {
     }
   }
 }
+
+// ------------------------ WatertightTriangleIntersect ------------------------
+
+TEST(WatertightTriangleIntersect, MatchesTriangleIntersect) {
+  auto mesh       = Memory::alloc<TriangleMeshResource>();
+  mesh->vertices  = {Vec3f(0, 0, 0), Vec3f(1, 0, 0), Vec3f(0, 1, 0)};
+  mesh->v_indices = {0, 1, 2};
+
+  PackedTriangles triangles;
+  triangles.push_back(*mesh, 0);
+
+  Ray r(Vec3f(0.2, 0.3, -1.0), Unit(Vec3f(0.1, 0, 1)));
+  Ray reference_r = r;
+  SurfaceInteraction si, reference_si;
+  ASSERT_TRUE(triangles.intersect(r, 0, mesh, si));
+  ASSERT_TRUE(TriangleIntersect(reference_r, 0, mesh, reference_si));
+  EXPECT_NEAR(r.t_max, reference_r.t_max, kLooseEp);
+  ExpectNear3(si.p, reference_si.p);
+
+  // Outside the triangle or the time range
+  Float t;
+  Vec3f b;
+  EXPECT_FALSE(WatertightTriangleIntersect(
+      Ray(Vec3f(2, 2, -1), Vec3f(0, 0, 1)), mesh->vertices[0],
+      mesh->vertices[1], mesh->vertices[2], &t, &b));
+  EXPECT_FALSE(WatertightTriangleIntersect(
+      Ray(Vec3f(0.2, 0.3, -1), Vec3f(0, 0, 1), RAY_DEFAULT_MIN, 0.5),
+      mesh->vertices[0], mesh->vertices[1], mesh->vertices[2], &t, &b));
+}
+
+TEST(WatertightTriangleIntersect, SharedEdgeIsNotMissed) {
+  // Two triangles sharing the diagonal of the unit square
+  const Vec3f p00(0, 0, 0), p10(1, 0, 0), p01(0, 1, 0), p11(1, 1, 0);
+
+  int n_missed = 0;
+  for (int i = 1; i < 64; ++i) {
+    // Points exactly on the diagonal, approached from varying directions
+    const Float s = i / 64.0F;
+    const Vec3f target(s, 1 - s, 0);
+    const Vec3f origin(s * 0.3F, 0.7F - s, -1.0F);
+    const Ray ray(origin, Unit(target - origin));
+
+    Float t;
+    Vec3f b;
+    const bool hit_lower =
+        WatertightTriangleIntersect(ray, p00, p10, p01, &t, &b);
+    const bool hit_upper =
+        WatertightTriangleIntersect(ray, p10, p11, p01, &t, &b);
+    if (!hit_lower && !hit_upper) ++n_missed;
+  }
+
+  EXPECT_EQ(n_missed, 0);
+}
+
+// ------------------------ Shape::occluded ------------------------
+
+TEST(SphereOccluded, MatchesIntersect) {
+  Properties props;
+  props.setProperty<Vec3f>("center", Vec3f(0, 0, 0));
+  props.setProperty<Float>("radius", 1.0F);
+  Sphere sphere(props);
+
+  // Through the center, tangent-free miss, and a range ending before the hit
+  const Ray hit_ray(Vec3f(-3, 0, 0), Vec3f(1, 0, 0));
+  const Ray miss_ray(Vec3f(-3, 2, 0), Vec3f(1, 0, 0));
+  const Ray short_ray(Vec3f(-3, 0, 0), Vec3f(1, 0, 0), RAY_DEFAULT_MIN, 1.5);
+  for (const auto &ray : {hit_ray, miss_ray, short_ray}) {
+    Ray local_ray = ray;
+    SurfaceInteraction si;
+    EXPECT_EQ(sphere.occluded(ray), sphere.intersect(local_ray, si));
+  }
+  EXPECT_TRUE(sphere.occluded(hit_ray));
+  EXPECT_FALSE(sphere.occluded(short_ray));
+}
+
+// ------------------------ Shape::intersectHit ------------------------
+
+TEST(SphereIntersectHit, DefersSurfaceInteraction) {
+  Properties props;
+  props.setProperty<Vec3f>("center", Vec3f(0, 0, 0));
+  props.setProperty<Float>("radius", 1.0F);
+  Sphere sphere(props);
+
+  HitRecord hit;
+  Ray miss_ray(Vec3f(-3, 2, 0), Vec3f(1, 0, 0));
+  EXPECT_FALSE(sphere.intersectHit(miss_ray, hit));
+  EXPECT_EQ(miss_ray.t_max, RAY_DEFAULT_MAX);
+
+  Ray hit_ray(Vec3f(-3, 0.5, 0), Vec3f(1, 0, 0));
+  ASSERT_TRUE(sphere.intersectHit(hit_ray, hit));
+  EXPECT_NEAR(hit_ray.t_max, 3 - std::sqrt(0.75F), kLooseEp);
+
+  Ray reference_ray(Vec3f(-3, 0.5, 0), Vec3f(1, 0, 0));
+  SurfaceInteraction si, reference_si;
+  sphere.computeSurfaceInteraction(hit_ray, hit, si);
+  ASSERT_TRUE(sphere.intersect(reference_ray, reference_si));
+  ExpectNear3(si.p, reference_si.p);
+  ExpectNear3(si.normal, reference_si.normal);
+  ExpectNear3(si.p, Vec3f(-std::sqrt(0.75F), 0.5, 0));
+}
+
+TEST(TriangleIntersectHit, RecordsTheClosestTriangle) {
+  // Two parallel triangles, the closer one at z = 1
+  auto mesh       = Memory::alloc<TriangleMeshResource>();
+  mesh->vertices  = {Vec3f(0, 0, 2), Vec3f(1, 0, 2), Vec3f(0, 1, 2),
+      Vec3f(0, 0, 1), Vec3f(1, 0, 1), Vec3f(0, 1, 1)};
+  mesh->v_indices = {0, 1, 2, 3, 4, 5};
+
+  Accel accel;
+  accel.setTriangleMesh(mesh);
+  accel.build();
+
+  Ray r(Vec3f(0.2, 0.3, -1.0), Vec3f(0, 0, 1));
+  HitRecord hit;
+  ASSERT_TRUE(accel.intersectHit(r, hit));
+  EXPECT_EQ(hit.index, 1);
+  EXPECT_NEAR(r.t_max, 2.0, kLooseEp);
+  ExpectNear3(hit.b, Vec3f(0.5, 0.2, 0.3));
+
+  SurfaceInteraction si;
+  accel.computeSurfaceInteraction(hit, si);
+  ExpectNear3(si.p, Vec3f(0.2, 0.3, 1.0));
+}
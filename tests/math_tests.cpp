@@ -122,4 +122,60 @@ TEST(Math, UniformSampleSphere) {
 
   result /= N;
   EXPECT_NEAR(result, 2 * PI, eps);
-}
\ No newline at end of file
+}
+
+TEST(Math, PCG32AdvanceSkipsNumbers) {
+  PCG32 stepped(7, 171), skipped(7, 171);
+  for (int i = 0; i < 1000; ++i) stepped();
+  skipped.advance(1000);
+  for (int i = 0; i < 16; ++i) EXPECT_EQ(stepped(), skipped());
+}
+
+TEST(Math, SamplerIsReproduciblePerPixelSample) {
+  // The numbers of a sample do not depend on what was drawn before
+  Sampler a, b;
+  a.setSeed(3);
+  b.setSeed(3);
+  b.setPixelIndex2D(Vec2i(5, 9));
+  for (int i = 0; i < 100; ++i) b.get1D();
+
+  a.setPixelIndex2D(Vec2i(2, 4));
+  b.setPixelIndex2D(Vec2i(2, 4));
+  a.startPixelSample(6);
+  b.startPixelSample(6);
+  for (int i = 0; i < 8; ++i) EXPECT_EQ(a.get1D(), b.get1D());
+
+  // Resuming at a dimension continues the same numbers
+  a.startPixelSample(1);
+  a.get2D();
+  const Float expected = a.get1D();
+  b.startPixelSample(1, 2);
+  EXPECT_EQ(b.getDimension(), 2);
+  EXPECT_EQ(b.get1D(), expected);
+
+  // Other pixels, samples and seeds draw other numbers
+  a.startPixelSample(0);
+  b.setSeed(4);
+  b.setPixelIndex2D(Vec2i(2, 4));
+  EXPECT_NE(a.get1D(), b.get1D());
+}
+
+TEST(Math, LowDiscrepancySamplersStratifyPixels) {
+  for (const auto type :
+      {ESamplerType::EHalton, ESamplerType::ESobol, ESamplerType::EOwenSobol}) {
+    Sampler sampler;
+    sampler.setType(type, 16);
+    sampler.setPixelIndex2D(Vec2i(7, 3));
+
+    // Every stratum of the first dimension is hit exactly once
+    std::array<int, 16> strata{};
+    for (int i = 0; i < 16; ++i) {
+      sampler.startPixelSample(i);
+      const Vec2f u = sampler.getPixelSample() - Vec2f(7, 3);
+      EXPECT_GE(u.y, 0);
+      EXPECT_LT(u.y, 1);
+      strata[static_cast<int>(u.x * 16)]++;
+    }
+    for (int count : strata) EXPECT_EQ(count, 1);
+  }
+}
@@ -0,0 +1,80 @@
+/**
+ * @file parallel_tests.cpp
+ * @brief Tests for the executors in parallel_utils.h
+ * @version 0.1
+ */
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <atomic>
+
+#include "rdr/parallel_utils.h"
+#include "rdr/rdr.h"
+
+using namespace RDR_NAMESPACE_NAME;
+
+namespace {
+std::atomic<int> n_constructed_tls{0};
+
+struct CountedTLS {
+  CountedTLS() { ++n_constructed_tls; }
+  int n_tasks{0};
+};
+
+void ExpectEveryTaskRunsOnce(const ExecutorSettings &settings) {
+  constexpr int N_TASKS = 2048;
+  vector<std::atomic<int>> runs(N_TASKS);
+  n_constructed_tls = 0;
+
+  ParallelExecute<CountedTLS>(
+      settings, 0, N_TASKS, [&](int index, CountedTLS &tls) {
+        // Imbalanced tasks, so that the workers have to steal
+        if (index < N_TASKS / 8)
+          std::this_thread::sleep_for(std::chrono::microseconds(200));
+        ++tls.n_tasks;
+        ++runs[index];
+      });
+
+  for (int i = 0; i < N_TASKS; ++i) EXPECT_EQ(runs[i], 1) << "task " << i;
+  EXPECT_GE(n_constructed_tls, 1);
+  EXPECT_LE(n_constructed_tls, settings.num_threads);
+}
+}  // namespace
+
+TEST(Parallel, OMPExecutorRunsEveryTaskOnce) {
+  ExecutorSettings settings;
+  settings.backend     = ExecutorSettings::EBackend::EOpenMP;
+  settings.num_threads = 4;
+  ExpectEveryTaskRunsOnce(settings);
+}
+
+TEST(Parallel, ThreadExecutorRunsEveryTaskOnce) {
+  ExecutorSettings settings;
+  settings.backend     = ExecutorSettings::EBackend::EThread;
+  settings.num_threads = 4;
+  ExpectEveryTaskRunsOnce(settings);
+}
+
+TEST(Parallel, WorkStealingQueuesDrainEveryTask) {
+  // More queues than tasks leaves some of them empty from the start
+  detail_::WorkStealingQueues<int> queues(10, 13, 8);
+  vector<int> popped;
+  int index = 0;
+  while (queues.pop(5, index)) popped.push_back(index);
+  std::sort(popped.begin(), popped.end());
+  EXPECT_EQ(popped, vector<int>({10, 11, 12}));
+}
+
+TEST(Parallel, ExecutorSettingsFromProperties) {
+  Properties props;
+  props.setProperty<std::string>("executor", "thread");
+  props.setProperty<int>("threads", 3);
+  const ExecutorSettings settings(props);
+  EXPECT_EQ(settings.backend, ExecutorSettings::EBackend::EThread);
+  EXPECT_EQ(settings.num_threads, 3);
+
+  Properties unknown;
+  unknown.setProperty<std::string>("executor", "tbb");
+  EXPECT_THROW(ExecutorSettings{unknown}, rdr_exception);
+}